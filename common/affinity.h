@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+// Thread placement for benchmarks that run one thread per core.
+namespace bench {
+
+// CPUs this process may run on, in increasing order; honours taskset and
+// cpusets, so isolated cores handed to the benchmark are exactly these.
+inline std::vector<int> allowed_cpus() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return cpus;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    return cpus;
+}
+
+// Pins `thread` to `cpu`; false if the kernel refused, e.g. for a CPU
+// outside allowed_cpus().
+inline bool pin_thread(pthread_t thread, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+inline bool pin_current_thread(int cpu) {
+    return pin_thread(pthread_self(), cpu);
+}
+
+} // namespace bench
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <format>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "histogram.h"
+#include "perf.h"
+#include "tsc.h"
+
+// Header-only benchmark harness shared by the experiments. bench::run
+// warms the function up, grows the calls per sample until one sample is
+// long enough for the clock to resolve, then keeps taking samples until
+// both a minimum count and a minimum time are reached. Every sample is
+// kept, so Stats carries real percentiles instead of a mean and a max.
+// Times are nanoseconds per call.
+//
+//     const bench::Stats s = bench::run("mul_simd/256", [&] { return a.mul_simd(b); });
+//     std::println("{} calls/s", bench::per_second(s));
+//     report.add(s);
+//     report.save(argc, argv);   // --csv=PATH and/or --json=PATH
+//
+// The timers and run() are templated on a std::chrono style clock, so
+// another time source can be swapped in without touching the callers;
+// bench::TscClock (tsc.h) is the cheap one for very short samples.
+namespace bench {
+
+// Forces value to be materialised, in a register or in memory, so the
+// computation producing it can not be dropped as dead.
+template<typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template<typename T>
+inline void DoNotOptimize(T& value) {
+    if constexpr (std::is_trivially_copyable_v<T> && sizeof(T) <= sizeof(void*))
+        asm volatile("" : "+r,m"(value) : : "memory");
+    else
+        asm volatile("" : "+m,r"(value) : : "memory");
+}
+
+// Makes every pending store visible and every later load re-read memory.
+inline void ClobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+// Writes the milliseconds between construction and destruction to *out.
+template<typename Clock = std::chrono::steady_clock>
+class [[nodiscard]] ScopeTimer {
+private:
+    double* out_;
+    typename Clock::time_point start_;
+
+public:
+    ScopeTimer(double* out)
+        : out_(out)
+        , start_(Clock::now()) {}
+
+    ~ScopeTimer() {
+        const auto end = Clock::now();
+        *out_ = std::chrono::duration<double, std::milli>(end - start_).count();
+    }
+};
+
+// Nanoseconds since construction, read with end().
+template<typename Clock = std::chrono::steady_clock>
+class ManTimer {
+private:
+    typename Clock::time_point start_;
+
+public:
+    ManTimer()
+        : start_(Clock::now()) {}
+
+    double end() const {
+        const auto end = Clock::now();
+        return std::chrono::duration<double, std::nano>(end - start_).count();
+    }
+};
+
+struct Options {
+    double warmup_ms = 10;          // untimed calls before the first sample (0 for none)
+    double min_time_ms = 100;       // sample for at least this long...
+    std::size_t min_samples = 10;   // ...and at least this many times
+    std::size_t max_samples = 10'000;
+    double min_sample_ns = 10'000;  // calls per sample grow until one sample takes this long
+    Histogram* histogram = nullptr; // if set, every sample's ns per call is also recorded here, atomically so threads can share one
+    PerfCounterGroup* counters = nullptr; // if set, counted over the timed calls into Stats::counters
+};
+
+struct Stats {
+    std::string name;
+    std::size_t samples = 0;
+    std::size_t batch = 0;          // calls per sample
+    double mean = 0;
+    double stddev = 0;
+    double min = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+    PerfCounts counters;            // per call, when Options::counters was set
+
+    std::size_t iterations() const { return samples * batch; }
+};
+
+// p-th percentile (0..100) of sorted samples, interpolating linearly
+// between the two closest ranks.
+inline double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty())
+        return 0;
+
+    const double rank = p / 100 * (sorted.size() - 1);
+    const std::size_t below = static_cast<std::size_t>(rank);
+    const std::size_t above = std::min(below + 1, sorted.size() - 1);
+    return sorted[below] + (rank - below) * (sorted[above] - sorted[below]);
+}
+
+inline Stats summarize(std::string name, std::vector<double> samples, std::size_t batch) {
+    Stats stats;
+    stats.name = std::move(name);
+    stats.samples = samples.size();
+    stats.batch = batch;
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0;
+    for (const double s : samples)
+        sum += s;
+    stats.mean = sum / samples.size();
+
+    double squares = 0;
+    for (const double s : samples)
+        squares += (s - stats.mean) * (s - stats.mean);
+    stats.stddev = samples.size() > 1 ? std::sqrt(squares / (samples.size() - 1)) : 0;
+
+    stats.min  = samples.front();
+    stats.p50  = percentile(samples, 50);
+    stats.p90  = percentile(samples, 90);
+    stats.p99  = percentile(samples, 99);
+    stats.p999 = percentile(samples, 99.9);
+    stats.max  = samples.back();
+
+    return stats;
+}
+
+// Stats of everything recorded into a histogram, one call per value, for
+// samples collected from several threads or runs. Percentiles are bucket
+// upper bounds, as Histogram::percentile() gives them.
+inline Stats summarize(std::string name, const Histogram& histogram) {
+    Stats stats;
+    stats.name = std::move(name);
+    stats.samples = histogram.count();
+    stats.batch = 1;
+    stats.mean = histogram.mean();
+    stats.stddev = histogram.stddev();
+    stats.min = histogram.min();
+    stats.p50 = histogram.percentile(50);
+    stats.p90 = histogram.percentile(90);
+    stats.p99 = histogram.percentile(99);
+    stats.p999 = histogram.percentile(99.9);
+    stats.max = histogram.max();
+    return stats;
+}
+
+// Calls per second at the median.
+inline double per_second(const Stats& stats) {
+    return stats.p50 > 0 ? 1e9 / stats.p50 : 0;
+}
+
+namespace detail {
+
+template<typename F>
+inline void invoke(F& fn) {
+    if constexpr (std::is_void_v<std::invoke_result_t<F&>>) {
+        fn();
+    } else {
+        auto result = fn();
+        DoNotOptimize(result);
+    }
+}
+
+template<typename Clock, typename F>
+inline void warmup(F& fn, double warmup_ms) {
+    const ManTimer<Clock> timer;
+    while (timer.end() < warmup_ms * 1e6)
+        invoke(fn);
+}
+
+} // namespace detail
+
+// Samples fn() as described at the top of the file. A non-void result is
+// passed through DoNotOptimize.
+template<typename Clock = std::chrono::steady_clock, typename F>
+Stats run(std::string name, F&& fn, const Options& options = {}) {
+    detail::warmup<Clock>(fn, options.warmup_ms);
+
+    std::vector<double> samples;
+    samples.reserve(options.min_samples);
+    double total_ns = 0;
+    std::size_t calls = 0;
+
+    if (options.counters)
+        options.counters->start();
+
+    // The calibration round that reaches the target is a real sample, so
+    // slow functions are not called once more just to size the batch.
+    std::size_t batch = 1;
+    for (;;) {
+        const ManTimer<Clock> timer;
+        for (std::size_t i = 0; i < batch; ++i)
+            detail::invoke(fn);
+        const double elapsed = timer.end();
+        calls += batch;
+
+        if (elapsed >= options.min_sample_ns || batch >= (std::size_t(1) << 30)) {
+            samples.push_back(elapsed / batch);
+            if (options.histogram)
+                options.histogram->record_atomic(std::llround(elapsed / batch));
+            total_ns += elapsed;
+            break;
+        }
+
+        // Aim straight for the target once the timing means something,
+        // but never grow more than tenfold at once.
+        const double wanted = elapsed > 0 ? batch * options.min_sample_ns / elapsed : batch * 10.0;
+        batch = std::clamp<std::size_t>(static_cast<std::size_t>(std::ceil(wanted)), batch * 2, batch * 10);
+    }
+
+    while (samples.size() < options.max_samples
+           && (samples.size() < options.min_samples || total_ns < options.min_time_ms * 1e6)) {
+        const ManTimer<Clock> timer;
+        for (std::size_t i = 0; i < batch; ++i)
+            detail::invoke(fn);
+        const double elapsed = timer.end();
+        calls += batch;
+
+        samples.push_back(elapsed / batch);
+        if (options.histogram)
+            options.histogram->record_atomic(std::llround(elapsed / batch));
+        total_ns += elapsed;
+    }
+
+    Stats stats = summarize(std::move(name), std::move(samples), batch);
+    if (options.counters)
+        stats.counters = options.counters->stop().per(calls);
+    return stats;
+}
+
+// run() for functions that need a fresh state per call, such as a cold
+// cache: setup() runs untimed before every sample and each sample is a
+// single call.
+template<typename Clock = std::chrono::steady_clock, typename Setup, typename F>
+Stats run_fresh(std::string name, Setup&& setup, F&& fn, const Options& options = {}) {
+    const ManTimer<Clock> warmup_timer;
+    while (warmup_timer.end() < options.warmup_ms * 1e6) {
+        setup();
+        detail::invoke(fn);
+    }
+
+    std::vector<double> samples;
+    samples.reserve(options.min_samples);
+    double total_ns = 0;
+
+    // Counting is switched on around fn() only, so setup() is left out.
+    if (options.counters)
+        options.counters->reset();
+
+    while (samples.size() < options.max_samples
+           && (samples.size() < options.min_samples || total_ns < options.min_time_ms * 1e6)) {
+        setup();
+
+        if (options.counters)
+            options.counters->enable();
+        const ManTimer<Clock> timer;
+        detail::invoke(fn);
+        const double elapsed = timer.end();
+        if (options.counters)
+            options.counters->disable();
+
+        samples.push_back(elapsed);
+        if (options.histogram)
+            options.histogram->record_atomic(std::llround(elapsed));
+        total_ns += elapsed;
+    }
+
+    Stats stats = summarize(std::move(name), std::move(samples), 1);
+    if (options.counters)
+        stats.counters = options.counters->read().per(stats.samples);
+    return stats;
+}
+
+// Every Stats of one program run, written out as CSV or JSON for
+// comparing runs and experiments.
+class Report {
+private:
+    std::vector<Stats> results_;
+
+    // RFC 4180: a quote inside a quoted field is doubled.
+    static std::string escape_csv(std::string_view text) {
+        std::string escaped;
+        for (const char c : text) {
+            if (c == '"')
+                escaped += '"';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    static std::string escape_json(std::string_view text) {
+        std::string escaped;
+        for (const char c : text) {
+            if (static_cast<unsigned char>(c) < 0x20) {
+                escaped += std::format("\\u{:04x}", static_cast<unsigned>(c));
+                continue;
+            }
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+public:
+
+    void add(Stats stats) {
+        results_.push_back(std::move(stats));
+    }
+
+    const std::vector<Stats>& results() const { return results_; }
+
+    // Counters go in one last column as "name=value;..." per call, so the
+    // columns stay the same whichever events were available.
+    void write_csv(std::ostream& out) const {
+        out << "name,samples,batch,mean_ns,stddev_ns,min_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,counters\n";
+        for (const Stats& s : results_) {
+            std::string counters;
+            for (const auto& [n, v] : s.counters.values)
+                counters += std::format("{}{}={:.3f}", counters.empty() ? "" : ";", n, v);
+
+            out << std::format("\"{}\",{},{},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},\"{}\"\n",
+                               escape_csv(s.name), s.samples, s.batch, s.mean, s.stddev,
+                               s.min, s.p50, s.p90, s.p99, s.p999, s.max, escape_csv(counters));
+        }
+    }
+
+    void write_json(std::ostream& out) const {
+        out << "[\n";
+        for (std::size_t i = 0; i < results_.size(); ++i) {
+            const Stats& s = results_[i];
+
+            std::string counters;
+            for (const auto& [n, v] : s.counters.values)
+                counters += std::format("{}\"{}\": {:.3f}", counters.empty() ? "" : ", ", escape_json(n), v);
+
+            out << std::format("  {{\"name\": \"{}\", \"samples\": {}, \"batch\": {}, \"mean_ns\": {:.3f}, "
+                               "\"stddev_ns\": {:.3f}, \"min_ns\": {:.3f}, \"p50_ns\": {:.3f}, \"p90_ns\": {:.3f}, "
+                               "\"p99_ns\": {:.3f}, \"p999_ns\": {:.3f}, \"max_ns\": {:.3f}, \"counters\": {{{}}}}}{}\n",
+                               escape_json(s.name), s.samples, s.batch, s.mean, s.stddev,
+                               s.min, s.p50, s.p90, s.p99, s.p999, s.max, counters,
+                               i + 1 < results_.size() ? "," : "");
+        }
+        out << "]\n";
+    }
+
+    // Writes the report to the files named by --csv=PATH and --json=PATH
+    // among the program arguments; other arguments are ignored.
+    void save(int argc, char** argv) const {
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view arg(argv[i]);
+
+            if (arg.starts_with("--csv=")) {
+                std::ofstream out{std::string(arg.substr(6))};
+                write_csv(out);
+            } else if (arg.starts_with("--json=")) {
+                std::ofstream out{std::string(arg.substr(7))};
+                write_json(out);
+            }
+        }
+    }
+};
+
+} // namespace bench
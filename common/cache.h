@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// Putting a benchmark's input into a known cache state before each run,
+// instead of writing a few hundred MB and hoping:
+//
+//     bench::CacheState cache;                  // allocated once
+//     bench::run_fresh("cold", [&] { bench::evict(data, bytes); }, fn);
+//     bench::run_fresh("l2", [&] { cache.prime(data, bytes, bench::CacheLevel::L2); }, fn);
+//     bench::run_fresh("no llc", [&] { cache.invalidate_llc(); }, fn);
+//
+// evict() costs one flush per line of the input. invalidate_llc() reads
+// a buffer a few times the LLC, allocated and faulted in once, so it adds
+// no page faults or TLB churn of its own after the first call.
+namespace bench {
+
+enum class CacheLevel { L1, L2, LLC };
+
+inline std::size_t cache_line_size() {
+    const long bytes = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+    return bytes > 0 ? std::size_t(bytes) : 64;
+}
+
+// Capacity the OS reports for `level`, the last level being L3 if there
+// is one; 0 when unknown.
+inline std::size_t cache_size(CacheLevel level) {
+    long bytes = 0;
+    switch (level) {
+        case CacheLevel::L1: bytes = sysconf(_SC_LEVEL1_DCACHE_SIZE); break;
+        case CacheLevel::L2: bytes = sysconf(_SC_LEVEL2_CACHE_SIZE); break;
+        case CacheLevel::LLC:
+            bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+            if (bytes <= 0)
+                bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+            break;
+    }
+    return bytes > 0 ? std::size_t(bytes) : 0;
+}
+
+namespace detail {
+
+#if defined(__x86_64__) || defined(__i386__)
+// CPUID 7.0, EBX bit 23.
+inline bool has_clflushopt() {
+    static const bool supported = [] {
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+            return false;
+        return bool((ebx >> 23) & 1);
+    }();
+    return supported;
+}
+
+// clflushopt is not ordered against other flushes of different lines, so
+// a buffer goes out in parallel; clflush serialises every line.
+[[gnu::target("clflushopt")]] inline void flush_lines_opt(const char* begin, const char* end, std::size_t line) {
+    for (const char* p = begin; p < end; p += line)
+        _mm_clflushopt(const_cast<char*>(p));
+}
+#endif
+
+// Start of the line holding `data`.
+inline const char* line_begin(const void* data, std::size_t line) {
+    return reinterpret_cast<const char*>(reinterpret_cast<std::uintptr_t>(data) & ~(line - 1));
+}
+
+// Reads one byte of every line in [begin, end).
+inline void touch_lines(const char* begin, const char* end, std::size_t line) {
+    for (const char* p = begin; p < end; p += line)
+        static_cast<void>(*static_cast<const volatile char*>(p));
+}
+
+} // namespace detail
+
+// Writes back and drops every line of the buffer from every cache level,
+// so the next access to it goes to memory.
+inline void evict(const void* data, std::size_t bytes) {
+    const std::size_t line = cache_line_size();
+    const char* begin = detail::line_begin(data, line);
+    const char* end = static_cast<const char*>(data) + bytes;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (detail::has_clflushopt()) {
+        detail::flush_lines_opt(begin, end, line);
+    } else {
+        for (const char* p = begin; p < end; p += line)
+            _mm_clflush(p);
+    }
+    _mm_mfence();
+#elif defined(__aarch64__)
+    for (const char* p = begin; p < end; p += line)
+        asm volatile("dc civac, %0" : : "r"(p) : "memory");
+    asm volatile("dsb ish" : : : "memory");
+#else
+    static_cast<void>(begin);
+    static_cast<void>(end);
+#endif
+}
+
+// Owns the scratch memory for prime() and invalidate_llc().
+class CacheState {
+private:
+    std::vector<char> scratch_;
+    std::size_t line_ = cache_line_size();
+    std::size_t l1_ = cache_size(CacheLevel::L1);
+    std::size_t l2_ = cache_size(CacheLevel::L2);
+
+public:
+    // Scratch of `llc_multiple` times the LLC (32 MiB of LLC assumed when
+    // the OS does not say). Streaming through twice the capacity misses on
+    // every line under LRU; raise it for LLCs whose adaptive replacement
+    // keeps some lines through a scan.
+    explicit CacheState(std::size_t llc_multiple = 2)
+        : scratch_((cache_size(CacheLevel::LLC) ? cache_size(CacheLevel::LLC) : std::size_t(32) << 20) * llc_multiple, 1) {}
+
+    // Leaves the buffer resident in `level` and evicted from the levels
+    // above it: loads it into L1, then for L2 or LLC streams twice that
+    // level's upper neighbour worth of scratch through to push it down.
+    // The buffer has to fit in `level` for this to mean anything.
+    void prime(const void* data, std::size_t bytes, CacheLevel level) {
+        detail::touch_lines(detail::line_begin(data, line_), static_cast<const char*>(data) + bytes, line_);
+
+        std::size_t displace = 0;
+        if (level == CacheLevel::L2)
+            displace = 2 * (l1_ ? l1_ : std::size_t(32) << 10);
+        else if (level == CacheLevel::LLC)
+            displace = 2 * (l2_ ? l2_ : std::size_t(1) << 20);
+
+        displace = std::min(displace, scratch_.size());
+        detail::touch_lines(scratch_.data(), scratch_.data() + displace, line_);
+    }
+
+    // Replaces everything in the caches with scratch lines. Cheaper than
+    // evict() on a buffer far bigger than the LLC, and also clears out
+    // whatever else the benchmark touched.
+    void invalidate_llc() {
+        detail::touch_lines(scratch_.data(), scratch_.data() + scratch_.size(), line_);
+    }
+
+    std::size_t scratch_bytes() const { return scratch_.size(); }
+};
+
+} // namespace bench
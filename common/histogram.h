@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <ostream>
+#include <type_traits>
+
+// Fixed-size log-linear latency histogram in the style of HdrHistogram.
+// Values below 2^(SUB_BITS + 1) get a bucket each; above that every power
+// of two is split into 2^SUB_BITS equal buckets, so a bucket is never wider
+// than 1/128 of its values (SUB_BITS = 7) and the whole uint64_t range
+// fits in one array of 58 KiB of counters:
+//
+//     [0, 128)      width 1
+//     [128, 256)    width 1
+//     [256, 512)    width 2
+//     [512, 1024)   width 4   ...
+//
+// record() is a count-leading-zeros, a shift and an increment, with no
+// allocation, so it can go on the hot path for every sample. Histograms
+// merge by adding counters; the object is trivially copyable, so it can
+// live in MAP_SHARED memory between processes, and record_atomic() lets
+// threads share one. Units are whatever the caller records, usually ns.
+namespace bench {
+
+class Histogram {
+public:
+    static constexpr unsigned SUB_BITS = 7;
+    static constexpr std::size_t SUB_COUNT = std::size_t(1) << SUB_BITS;
+    static constexpr std::size_t BUCKETS = (65 - SUB_BITS) * SUB_COUNT;
+
+private:
+    std::array<std::uint64_t, BUCKETS> counts_{};
+    std::uint64_t total_ = 0;
+    std::uint64_t min_ = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t max_ = 0;
+
+public:
+    // Bucket of value: values up to SUB_COUNT * 2 map to themselves, then
+    // `shift` is how many low bits are dropped to fit in SUB_BITS + 1.
+    static constexpr std::size_t index(std::uint64_t value) {
+        if (value < SUB_COUNT * 2)
+            return value;
+        const unsigned shift = std::bit_width(value) - (SUB_BITS + 1);
+        return shift * SUB_COUNT + (value >> shift);
+    }
+
+    static constexpr std::uint64_t lowest(std::size_t index) {
+        if (index < SUB_COUNT * 2)
+            return index;
+        const unsigned shift = index / SUB_COUNT - 1;
+        return (index - shift * SUB_COUNT) << shift;
+    }
+
+    // Largest value sharing the bucket; what percentiles report, so a tail
+    // is never understated.
+    static constexpr std::uint64_t highest(std::size_t index) {
+        if (index < SUB_COUNT * 2)
+            return index;
+        const unsigned shift = index / SUB_COUNT - 1;
+        return lowest(index) + ((std::uint64_t(1) << shift) - 1);
+    }
+
+    void record(std::uint64_t value, std::uint64_t count = 1) {
+        counts_[index(value)] += count;
+        total_ += count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    // record() for a histogram shared between threads or processes.
+    void record_atomic(std::uint64_t value, std::uint64_t count = 1) {
+        std::atomic_ref(counts_[index(value)]).fetch_add(count, std::memory_order_relaxed);
+        std::atomic_ref(total_).fetch_add(count, std::memory_order_relaxed);
+
+        std::atomic_ref min(min_);
+        for (std::uint64_t seen = min.load(std::memory_order_relaxed);
+             value < seen && !min.compare_exchange_weak(seen, value, std::memory_order_relaxed);)
+            ;
+        std::atomic_ref max(max_);
+        for (std::uint64_t seen = max.load(std::memory_order_relaxed);
+             value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed);)
+            ;
+    }
+
+    void merge(const Histogram& other) {
+        for (std::size_t i = 0; i < BUCKETS; ++i)
+            counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset() { *this = Histogram(); }
+
+    std::uint64_t count() const { return total_; }
+    std::uint64_t min() const { return total_ ? min_ : 0; }
+    std::uint64_t max() const { return max_; }
+
+    // Mean of the bucket midpoints.
+    double mean() const {
+        if (total_ == 0)
+            return 0;
+
+        double sum = 0;
+        for (std::size_t i = 0; i < BUCKETS; ++i)
+            if (counts_[i])
+                sum += counts_[i] * ((lowest(i) + highest(i)) / 2.0);
+        return sum / total_;
+    }
+
+    // Sample standard deviation of the bucket midpoints.
+    double stddev() const {
+        if (total_ < 2)
+            return 0;
+
+        const double m = mean();
+        double squares = 0;
+        for (std::size_t i = 0; i < BUCKETS; ++i) {
+            if (counts_[i]) {
+                const double d = (lowest(i) + highest(i)) / 2.0 - m;
+                squares += counts_[i] * d * d;
+            }
+        }
+        return std::sqrt(squares / (total_ - 1));
+    }
+
+    // Smallest recorded bucket with at least p percent (0..100) of the
+    // values at or below it, as that bucket's highest value, clamped to
+    // the exact max.
+    std::uint64_t percentile(double p) const {
+        if (total_ == 0)
+            return 0;
+
+        const double wanted = std::clamp(p, 0.0, 100.0) / 100 * total_;
+        const std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(wanted + 0.5));
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank)
+                return std::min(highest(i), max_);
+        }
+        return max_;
+    }
+
+    // The usual percentiles, one per line, scaled by `scale` (e.g. 1e-3 to
+    // print ns as us).
+    void write_text(std::ostream& out, double scale = 1) const {
+        out << std::format("{:>10} {:>14}\n", "PERCENTILE", "VALUE");
+        for (const double p : {0.0, 50.0, 75.0, 90.0, 99.0, 99.9, 99.99, 100.0})
+            out << std::format("{:>10} {:>14.3f}\n", p, percentile(p) * scale);
+        out << std::format("{:>10} {:>14}\n", "COUNT", total_);
+    }
+
+    // One line per non-empty bucket: its value range, count and the
+    // fraction of values at or below it.
+    void write_csv(std::ostream& out) const {
+        out << "low,high,count,cumulative\n";
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKETS; ++i) {
+            if (counts_[i] == 0)
+                continue;
+            seen += counts_[i];
+            out << std::format("{},{},{},{:.6f}\n", lowest(i), highest(i), counts_[i], double(seen) / total_);
+        }
+    }
+};
+
+static_assert(std::is_trivially_copyable_v<Histogram>);
+
+} // namespace bench
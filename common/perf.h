@@ -0,0 +1,384 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware counters opened as one perf_event group, so they count exactly
+// the same instructions and are read together with a single read():
+//
+//     auto counters = bench::PerfCounterGroup::make();
+//     {
+//         auto _ = bench::PerfScope(counters, "mul_simd", iterations);
+//         for (...) a.mul_simd(b);
+//     }   // mul_simd: IPC 2.31, L1-dcache-load-misses 812.4, ... per iteration
+//
+// The kernel multiplexes groups that do not fit in the PMU; counts are
+// scaled by time_enabled / time_running to estimate the full run. Events
+// this machine (or VM) does not have are left out of the group instead of
+// failing it.
+//
+// For regions too short for a read() syscall, such as one queue hop or one
+// update, snapshot() reads the raw counts from user space with rdpmc:
+//
+//     bench::PerfSnapshot before, after;
+//     counters->start();
+//     counters->snapshot(before);
+//     book.apply(message);
+//     counters->snapshot(after);
+//     const auto misses = counters->delta(before, after).get(bench::L1D_MISSES.name);
+namespace bench {
+
+// Most events one group holds; snapshots are fixed arrays of this size so
+// taking one never allocates.
+constexpr std::size_t PERF_MAX_EVENTS = 8;
+
+using PerfSnapshot = std::array<std::uint64_t, PERF_MAX_EVENTS>;
+
+// The hardware counter behind a perf mmap page, per the seqlock protocol
+// documented in linux/perf_event.h: the kernel bumps `lock` around every
+// update of the page (and when the task migrates), so the read is retried
+// until it saw a stable page. Counts while the event is not on the PMU are
+// in `offset` alone. nullopt if the page does not allow rdpmc.
+inline std::optional<std::uint64_t> rdpmc_read(const volatile perf_event_mmap_page* page) {
+#if defined(__x86_64__) || defined(__i386__)
+    std::uint32_t seq;
+    std::uint64_t count;
+
+    do {
+        seq = page->lock;
+        asm volatile("" ::: "memory");
+
+        if (!page->cap_user_rdpmc)
+            return std::nullopt;
+
+        const std::uint32_t index = page->index;
+        count = page->offset;
+        if (index && page->pmc_width) {
+            std::uint32_t lo, hi;
+            asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(index - 1));
+
+            // Sign-extend the pmc_width bits the counter actually has.
+            const unsigned shift = 64 - page->pmc_width;
+            const std::int64_t pmc = static_cast<std::int64_t>((std::uint64_t(hi) << 32 | lo) << shift) >> shift;
+            count += pmc;
+        }
+
+        asm volatile("" ::: "memory");
+    } while (page->lock != seq);
+
+    return count;
+#else
+    (void)page;
+    return std::nullopt;
+#endif
+}
+
+struct PerfEventSpec {
+    std::string_view name;
+    std::uint32_t type;
+    std::uint64_t config;
+};
+
+constexpr std::uint64_t hw_cache_config(std::uint64_t cache, std::uint64_t op, std::uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+constexpr PerfEventSpec CYCLES{"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES};
+constexpr PerfEventSpec INSTRUCTIONS{"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS};
+constexpr PerfEventSpec L1D_MISSES{
+    "L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+    hw_cache_config(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)
+};
+constexpr PerfEventSpec LLC_MISSES{
+    "LLC-load-misses", PERF_TYPE_HW_CACHE,
+    hw_cache_config(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)
+};
+constexpr PerfEventSpec DTLB_MISSES{
+    "dTLB-load-misses", PERF_TYPE_HW_CACHE,
+    hw_cache_config(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS)
+};
+constexpr PerfEventSpec DTLB_STORE_MISSES{
+    "dTLB-store-misses", PERF_TYPE_HW_CACHE,
+    hw_cache_config(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_MISS)
+};
+constexpr PerfEventSpec BRANCH_MISSES{"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES};
+
+constexpr std::array DEFAULT_EVENTS{CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, DTLB_MISSES, BRANCH_MISSES};
+
+// Counter values of one read, already scaled for multiplexing.
+struct PerfCounts {
+    std::vector<std::pair<std::string_view, double>> values;
+
+    bool empty() const { return values.empty(); }
+
+    std::optional<double> get(std::string_view name) const {
+        for (const auto& [n, v] : values)
+            if (n == name)
+                return v;
+        return std::nullopt;
+    }
+
+    std::optional<double> ipc() const {
+        const auto cycles = get(CYCLES.name);
+        const auto instructions = get(INSTRUCTIONS.name);
+        if (!cycles || !instructions || *cycles == 0)
+            return std::nullopt;
+        return *instructions / *cycles;
+    }
+
+    // Every value divided by iterations.
+    PerfCounts per(double iterations) const {
+        PerfCounts result = *this;
+        for (auto& [n, v] : result.values)
+            v /= iterations;
+        return result;
+    }
+
+    // "IPC 1.23, L1-dcache-load-misses 4.5, ..." without cycles and
+    // instructions, which the IPC stands for.
+    std::string summary() const {
+        std::string text;
+        if (const auto i = ipc())
+            text = std::format("IPC {:.2f}", *i);
+
+        for (const auto& [n, v] : values) {
+            if (ipc() && (n == CYCLES.name || n == INSTRUCTIONS.name))
+                continue;
+            text += std::format("{}{} {:.2f}", text.empty() ? "" : ", ", n, v);
+        }
+        return text;
+    }
+};
+
+class PerfCounterGroup {
+private:
+    static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
+                                int cpu, int group_fd, unsigned long flags) {
+        return syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
+    }
+
+    struct Member {
+        PerfEventSpec spec;
+        int fd;
+        std::uint64_t id;
+        perf_event_mmap_page* page;   // for rdpmc, nullptr if it could not be mapped
+    };
+
+    // members_[0] is the group leader.
+    std::vector<Member> members_;
+
+    PerfCounterGroup() = default;
+
+    int leader() const { return members_.front().fd; }
+
+public:
+
+    PerfCounterGroup(const PerfCounterGroup&) = delete;
+    PerfCounterGroup& operator=(const PerfCounterGroup&) = delete;
+
+    PerfCounterGroup(PerfCounterGroup&& other)
+        : members_(std::exchange(other.members_, {})) {}
+
+    PerfCounterGroup& operator=(PerfCounterGroup&& other) {
+        if (this == &other)
+            return *this;
+
+        close_all();
+        members_ = std::exchange(other.members_, {});
+        return *this;
+    }
+
+    ~PerfCounterGroup() noexcept {
+        close_all();
+    }
+
+    // Opens every event that exists on this machine for the calling
+    // thread, user space only; nullopt when none does.
+    static std::optional<PerfCounterGroup> make(std::span<const PerfEventSpec> events = DEFAULT_EVENTS) {
+        PerfCounterGroup group;
+
+        for (const PerfEventSpec& spec : events) {
+            if (group.members_.size() == PERF_MAX_EVENTS)
+                break;
+
+            struct perf_event_attr pe;
+            memset(&pe, 0, sizeof(pe));
+            pe.type = spec.type;
+            pe.size = sizeof(pe);
+            pe.config = spec.config;
+            pe.disabled = group.members_.empty();
+            pe.exclude_kernel = 1;
+            pe.exclude_hv = 1;
+            pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID
+                           | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            const int group_fd = group.members_.empty() ? -1 : group.leader();
+            const int fd = perf_event_open(&pe, 0, -1, group_fd, 0);
+            if (fd == -1)
+                continue;
+
+            std::uint64_t id = 0;
+            ioctl(fd, PERF_EVENT_IOC_ID, &id);
+
+            // Mapping the event is what lets the kernel grant rdpmc.
+            void* page = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+            group.members_.push_back({spec, fd, id, page == MAP_FAILED ? nullptr : static_cast<perf_event_mmap_page*>(page)});
+        }
+
+        if (group.members_.empty()) {
+            std::println("Error opening perf events");
+            return std::nullopt;
+        }
+        return group;
+    }
+
+    // Names of the events that opened, in group order.
+    std::vector<std::string_view> events() const {
+        std::vector<std::string_view> names;
+        for (const Member& m : members_)
+            names.push_back(m.spec.name);
+        return names;
+    }
+
+    void reset() { ioctl(leader(), PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP); }
+    void enable() { ioctl(leader(), PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP); }
+    void disable() { ioctl(leader(), PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP); }
+
+    void start() {
+        reset();
+        enable();
+    }
+
+    // All counters in one read(). Empty if the group never got onto the
+    // PMU (time_running == 0).
+    PerfCounts read() const {
+        // nr, time_enabled, time_running, then {value, id} per member.
+        std::vector<std::uint64_t> buffer(3 + 2 * members_.size());
+        const ssize_t bytes = ::read(leader(), buffer.data(), buffer.size() * sizeof(std::uint64_t));
+
+        PerfCounts counts;
+        if (bytes < static_cast<ssize_t>(3 * sizeof(std::uint64_t)))
+            return counts;
+
+        const std::uint64_t nr = buffer[0];
+        const std::uint64_t enabled = buffer[1];
+        const std::uint64_t running = buffer[2];
+        if (running == 0)
+            return counts;
+
+        const double scale = static_cast<double>(enabled) / running;
+        for (std::uint64_t i = 0; i < nr && i < members_.size(); ++i) {
+            const std::uint64_t value = buffer[3 + 2*i];
+            const std::uint64_t id = buffer[4 + 2*i];
+            for (const Member& m : members_)
+                if (m.id == id)
+                    counts.values.emplace_back(m.spec.name, value * scale);
+        }
+        return counts;
+    }
+
+    PerfCounts stop() {
+        disable();
+        return read();
+    }
+
+    // Whether snapshot() reads every counter with rdpmc; false means it
+    // falls back to one read() of the group.
+    bool uses_rdpmc() const {
+        for (const Member& m : members_)
+            if (!m.page || !rdpmc_read(m.page))
+                return false;
+        return true;
+    }
+
+    // Raw, unscaled counts since the last reset, in group order. A few
+    // dozen cycles per counter when rdpmc is allowed, so it can bracket a
+    // single operation; otherwise a read() syscall.
+    void snapshot(PerfSnapshot& out) const {
+        std::size_t i = 0;
+        for (; i < members_.size(); ++i) {
+            const auto count = members_[i].page ? rdpmc_read(members_[i].page) : std::nullopt;
+            if (!count)
+                break;
+            out[i] = *count;
+        }
+        if (i == members_.size())
+            return;
+
+        std::uint64_t buffer[3 + 2 * PERF_MAX_EVENTS];
+        const ssize_t bytes = ::read(leader(), buffer, sizeof(buffer));
+        const std::uint64_t nr = bytes >= static_cast<ssize_t>(sizeof(std::uint64_t)) ? buffer[0] : 0;
+
+        for (std::size_t m = 0; m < members_.size(); ++m) {
+            out[m] = 0;
+            for (std::uint64_t e = 0; e < nr && e < PERF_MAX_EVENTS; ++e)
+                if (buffer[4 + 2*e] == members_[m].id)
+                    out[m] = buffer[3 + 2*e];
+        }
+    }
+
+    // Named counts between two snapshots.
+    PerfCounts delta(const PerfSnapshot& before, const PerfSnapshot& after) const {
+        PerfCounts counts;
+        for (std::size_t i = 0; i < members_.size(); ++i)
+            counts.values.emplace_back(members_[i].spec.name, static_cast<double>(after[i] - before[i]));
+        return counts;
+    }
+
+private:
+    void close_all() {
+        // Members before the leader, which owns the group.
+        for (auto it = members_.rbegin(); it != members_.rend(); ++it) {
+            if (it->page)
+                munmap(it->page, sysconf(_SC_PAGESIZE));
+            close(it->fd);
+        }
+        members_.clear();
+    }
+};
+
+// Counts the scope with group and prints the counts per iteration when it
+// ends. A null group (counters unavailable) makes it a no-op.
+class [[nodiscard]] PerfScope {
+private:
+    PerfCounterGroup* group_;
+    std::string name_;
+    double iterations_;
+
+public:
+    PerfScope(PerfCounterGroup* group, std::string name, double iterations = 1)
+        : group_(group)
+        , name_(std::move(name))
+        , iterations_(iterations) {
+        if (group_)
+            group_->start();
+    }
+
+    PerfScope(std::optional<PerfCounterGroup>& group, std::string name, double iterations = 1)
+        : PerfScope(group ? &*group : nullptr, std::move(name), iterations) {}
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+    ~PerfScope() {
+        if (group_)
+            std::println("{}: {} per iteration", name_, group_->stop().per(iterations_).summary());
+    }
+};
+
+} // namespace bench
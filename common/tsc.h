@@ -0,0 +1,161 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define BENCH_HAVE_TSC 1
+#else
+#define BENCH_HAVE_TSC 0
+#endif
+
+// A std::chrono clock that reads the time stamp counter instead of going
+// through clock_gettime, so now() costs a fenced rdtsc and a multiply:
+// cheap enough to time single cache misses or queue hops.
+//
+//     const bench::ManTimer<bench::TscClock> timer;
+//     ...
+//     const double ns = timer.end();
+//
+// Ticks are turned into nanoseconds with a 32.32 fixed-point factor
+// measured against CLOCK_MONOTONIC_RAW the first time the clock is used;
+// call TscClock::calibrate() early to keep that off the timed path. Only
+// an invariant TSC (constant rate, not stopped in sleep states, checked
+// through cpuid) is trusted; without one, or off x86, now() falls back to
+// CLOCK_MONOTONIC_RAW itself.
+namespace bench {
+
+// Counter read for the start of a timed region: the lfence keeps rdtsc
+// from running before earlier instructions complete.
+inline std::uint64_t tsc_begin() {
+#if BENCH_HAVE_TSC
+    _mm_lfence();
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Counter read for the end of a timed region: rdtscp waits for earlier
+// instructions, and the lfence keeps later ones from starting before it.
+inline std::uint64_t tsc_end() {
+#if BENCH_HAVE_TSC
+    unsigned int aux;
+    const std::uint64_t ticks = __rdtscp(&aux);
+    _mm_lfence();
+    return ticks;
+#else
+    return 0;
+#endif
+}
+
+// Whether the CPU advertises an invariant TSC (CPUID 0x80000007, EDX bit 8).
+inline bool invariant_tsc() {
+#if BENCH_HAVE_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007)
+        return false;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (edx >> 8) & 1;
+#else
+    return false;
+#endif
+}
+
+inline std::int64_t monotonic_raw_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return std::int64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+struct TscCalibration {
+    bool use_tsc = false;
+    std::uint64_t base_ticks = 0;   // counter value at base_ns
+    std::int64_t base_ns = 0;       // CLOCK_MONOTONIC_RAW at base_ticks
+    std::uint64_t ns_per_tick = 0;  // 32.32 fixed point
+    double ticks_per_ns = 0;
+};
+
+// Ticks against CLOCK_MONOTONIC_RAW over `window_ns`. Each end is the
+// midpoint of two counter reads around clock_gettime, taken from the
+// tightest of a few tries so a preemption does not skew it.
+inline TscCalibration calibrate_tsc(std::int64_t window_ns = 20'000'000) {
+    TscCalibration calibration;
+    if (!invariant_tsc())
+        return calibration;
+
+    const auto pair = [] {
+        std::uint64_t best_ticks = 0;
+        std::int64_t best_ns = 0;
+        std::uint64_t best_gap = ~std::uint64_t(0);
+
+        for (int i = 0; i < 5; ++i) {
+            const std::uint64_t before = tsc_begin();
+            const std::int64_t ns = monotonic_raw_ns();
+            const std::uint64_t after = tsc_end();
+
+            if (after - before < best_gap) {
+                best_gap = after - before;
+                best_ticks = before + (after - before) / 2;
+                best_ns = ns;
+            }
+        }
+        return std::pair{best_ticks, best_ns};
+    };
+
+    const auto [start_ticks, start_ns] = pair();
+    while (monotonic_raw_ns() - start_ns < window_ns)
+        ;
+    const auto [end_ticks, end_ns] = pair();
+
+    if (end_ticks <= start_ticks || end_ns <= start_ns)
+        return calibration;
+
+    calibration.use_tsc = true;
+    calibration.base_ticks = end_ticks;
+    calibration.base_ns = end_ns;
+    calibration.ticks_per_ns = double(end_ticks - start_ticks) / double(end_ns - start_ns);
+    calibration.ns_per_tick = static_cast<std::uint64_t>(double(end_ns - start_ns) * 4294967296.0 / double(end_ticks - start_ticks));
+    return calibration;
+}
+
+class TscClock {
+public:
+    using rep = std::int64_t;
+    using period = std::nano;
+    using duration = std::chrono::nanoseconds;
+    using time_point = std::chrono::time_point<TscClock>;
+    static constexpr bool is_steady = true;
+
+    // Measured once, on the first call.
+    static const TscCalibration& calibrate() {
+        static const TscCalibration calibration = calibrate_tsc();
+        return calibration;
+    }
+
+    // False when now() is CLOCK_MONOTONIC_RAW instead of the counter.
+    static bool uses_tsc() { return calibrate().use_tsc; }
+
+    static double ticks_per_ns() { return calibrate().ticks_per_ns; }
+
+    // Counter ticks to nanoseconds on the CLOCK_MONOTONIC_RAW time line.
+    static time_point from_ticks(std::uint64_t ticks) {
+        const TscCalibration& c = calibrate();
+        const std::int64_t delta = static_cast<std::int64_t>(ticks - c.base_ticks);
+        const __int128 scaled = static_cast<__int128>(delta) * static_cast<__int128>(c.ns_per_tick);
+        return time_point(duration(c.base_ns + static_cast<std::int64_t>(scaled >> 32)));
+    }
+
+    static time_point now() {
+        if (!uses_tsc())
+            return time_point(duration(monotonic_raw_ns()));
+        return from_ticks(tsc_begin());
+    }
+};
+
+} // namespace bench
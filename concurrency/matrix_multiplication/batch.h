@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "dispatch.h"
+#include "mat.h"
+#include "rng.h"
+
+// Many small N x N matrices stored struct-of-arrays, for workloads that
+// multiply thousands of 4x4 or 8x8 pairs at once. Matrices are grouped
+// BATCH_LANES<T> at a time (16 for int32); inside a group, element (r, c)
+// of every matrix shares one 64-byte line, matrix l in lane l:
+//
+//     group g: [ (0,0) of m0..m15 ][ (0,1) of m0..m15 ] ... [ (N-1,N-1) ... ]
+//
+// so mul_batch runs every vector lane on a different matrix instead of
+// packing each tiny operand for the tiled kernel. The last group is padded
+// with zero matrices.
+template<typename T, std::size_t N>
+class MatrixBatch {
+private:
+
+    constexpr static std::size_t LANES = gemm::BATCH_LANES<T>;
+    constexpr static std::size_t GROUP_SIZE = N * N * LANES;
+
+    std::size_t count_ = 0;
+    T* data_ = nullptr;
+
+    std::size_t groups() const { return (count_ + LANES - 1) / LANES; }
+
+    std::size_t index(std::size_t matrix, std::size_t row, std::size_t col) const {
+        return (matrix / LANES) * GROUP_SIZE + (row * N + col) * LANES + matrix % LANES;
+    }
+
+public:
+
+    MatrixBatch() = default;
+
+    explicit MatrixBatch(std::size_t count)
+        : count_(count) {
+        const std::size_t bytes = groups() * GROUP_SIZE * sizeof(T);
+        if (bytes == 0)
+            return;
+
+        void* mem = std::aligned_alloc(64, bytes);
+        if (mem == nullptr)
+            throw std::bad_alloc();
+
+        std::memset(mem, 0, bytes);
+        data_ = static_cast<T*>(mem);
+    }
+
+    ~MatrixBatch() {
+        std::free(data_);
+    }
+
+    MatrixBatch(const MatrixBatch& other)
+        : MatrixBatch(other.count_) {
+        if (data_ != nullptr)
+            std::memcpy(data_, other.data_, groups() * GROUP_SIZE * sizeof(T));
+    }
+
+    MatrixBatch& operator=(const MatrixBatch& other) {
+        if (this == &other)
+            return *this;
+
+        MatrixBatch copy(other);
+        *this = std::move(copy);
+        return *this;
+    }
+
+    MatrixBatch(MatrixBatch&& other) noexcept
+        : count_(std::exchange(other.count_, 0))
+        , data_(std::exchange(other.data_, nullptr)) {}
+
+    MatrixBatch& operator=(MatrixBatch&& other) noexcept {
+        if (this == &other)
+            return *this;
+
+        std::free(data_);
+        count_ = std::exchange(other.count_, 0);
+        data_ = std::exchange(other.data_, nullptr);
+
+        return *this;
+    }
+
+    // Matrix m is matrix m of Philox stream `seed`, filled straight into
+    // the lanes (padding matrices stay zero).
+    static MatrixBatch make_random(
+        std::size_t count, T lower_bound, T upper_bound,
+        std::uint64_t seed = rng::next_seed()
+    ) {
+        MatrixBatch random_batch(count);
+
+        T values[N * N];
+        for (std::size_t m = 0; m < count; ++m) {
+            rng::fill_uniform(values, N * N, lower_bound, upper_bound, seed, m * N * N);
+            for (std::size_t i = 0; i < N * N; ++i)
+                random_batch(m, i / N, i % N) = values[i];
+        }
+
+        return random_batch;
+    }
+
+    std::size_t count() const { return count_; }
+
+    T& operator()(std::size_t matrix, std::size_t row, std::size_t col) {
+        return data_[index(matrix, row, col)];
+    }
+
+    const T& operator()(std::size_t matrix, std::size_t row, std::size_t col) const {
+        return data_[index(matrix, row, col)];
+    }
+
+    void set(std::size_t matrix, const SquareMatrix<T, N>& value) {
+        for (std::size_t r = 0; r < N; ++r)
+            for (std::size_t c = 0; c < N; ++c)
+                (*this)(matrix, r, c) = value(r, c);
+    }
+
+    SquareMatrix<T, N> get(std::size_t matrix) const {
+        SquareMatrix<T, N> value;
+        for (std::size_t r = 0; r < N; ++r)
+            for (std::size_t c = 0; c < N; ++c)
+                value(r, c) = (*this)(matrix, r, c);
+        return value;
+    }
+
+    // Pairwise product: matrix i of the result is matrix i of this batch
+    // times matrix i of other.
+    MatrixBatch mul_batch(
+        const MatrixBatch& other,
+        const gemm::BatchKernel<T, N>& kernel = gemm::best_batch_kernel<T, N>()
+    ) const {
+        if (count_ != other.count_)
+            throw std::invalid_argument("batch sizes do not match");
+
+        MatrixBatch product(count_);
+        kernel.mul(data_, other.data_, product.data_, groups());
+        return product;
+    }
+
+    bool operator==(const MatrixBatch& other) const {
+        if (count_ != other.count_)
+            return false;
+        return count_ == 0 || std::memcmp(data_, other.data_, groups() * GROUP_SIZE * sizeof(T)) == 0;
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+// What the CPU we are running on (rather than the one we were compiled for)
+// supports. AVX and AVX-512 also need the OS to save the wider registers on
+// context switch, which is checked through XCR0.
+struct CpuFeatures {
+    bool sse42      = false;
+    bool avx2       = false;
+    bool fma        = false;
+    bool avx512f    = false;
+    bool avx512bw   = false;
+    bool avx512vnni = false;
+    bool avxvnni    = false;
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+namespace detail {
+
+inline std::uint64_t xgetbv(std::uint32_t index) {
+    std::uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return (static_cast<std::uint64_t>(edx) << 32) | eax;
+}
+
+inline CpuFeatures detect_cpu_features() {
+    CpuFeatures features;
+
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return features;
+
+    features.sse42 = ecx & bit_SSE4_2;
+
+    const bool osxsave = ecx & bit_OSXSAVE;
+    const bool avx     = ecx & bit_AVX;
+    const bool fma     = ecx & bit_FMA;
+
+    constexpr std::uint64_t XCR0_YMM = 0x06;   // SSE + AVX state
+    constexpr std::uint64_t XCR0_ZMM = 0xe6;   // + opmask, ZMM_Hi256, Hi16_ZMM
+    const std::uint64_t xcr0 = osxsave ? xgetbv(0) : 0;
+    const bool os_ymm = (xcr0 & XCR0_YMM) == XCR0_YMM;
+    const bool os_zmm = (xcr0 & XCR0_ZMM) == XCR0_ZMM;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return features;
+
+    features.fma        = avx && fma && os_ymm;
+    features.avx2       = avx && os_ymm && (ebx & bit_AVX2);
+    features.avx512f    = os_zmm && (ebx & bit_AVX512F);
+    features.avx512bw   = features.avx512f && (ebx & bit_AVX512BW);
+    features.avx512vnni = features.avx512bw && (ecx & bit_AVX512VNNI);
+
+    // Subleaf 0 reports the highest subleaf in eax.
+    if (eax >= 1 && __get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx))
+        features.avxvnni = features.avx2 && (eax & bit_AVXVNNI);
+
+    return features;
+}
+
+} // namespace detail
+
+inline const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = detail::detect_cpu_features();
+    return features;
+}
+
+#else
+
+inline const CpuFeatures& cpu_features() {
+    static const CpuFeatures features;
+    return features;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+
+#include "cpu_features.h"
+#include "gemm.h"
+
+// Runtime kernel selection. tile.inl is compiled once more per ISA tier
+// below, each time into its own namespace under #pragma GCC target, so the
+// packing, microkernel and edge code of that tier is generated for that ISA
+// no matter what -march the binary was built with. available_kernels()
+// checks cpuid and lists what the running CPU supports.
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+namespace gemm::avx512 {
+#include "tile.inl"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+namespace gemm::avx2 {
+#include "tile.inl"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+namespace gemm::sse42 {
+#include "tile.inl"
+}
+#pragma GCC pop_options
+
+#endif
+
+namespace gemm {
+
+// Every kernel the running CPU can execute, best ISA first and each ISA's
+// default shape ahead of its other shapes. The last entries are always the
+// portable native_simd build.
+template<typename T>
+std::vector<Kernel<T>> available_kernels() {
+    std::vector<Kernel<T>> kernels;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const CpuFeatures& cpu = cpu_features();
+
+    if (cpu.avx512f)
+        avx512::append_kernels<T, avx512::GccVec<T, 64>>(kernels, "avx512");
+    if (cpu.avx2 && cpu.fma)
+        avx2::append_kernels<T, avx2::GccVec<T, 32>>(kernels, "avx2");
+    if (cpu.sse42)
+        sse42::append_kernels<T, sse42::GccVec<T, 16>>(kernels, "sse4.2");
+#endif
+
+    append_kernels<T, NativeVec<T>>(kernels, "native");
+    return kernels;
+}
+
+// What an untuned build runs: the best ISA's default shape.
+template<typename T>
+const Kernel<T>& default_kernel() {
+    static const Kernel<T> kernel = available_kernels<T>().front();
+    return kernel;
+}
+
+template<typename T, std::size_t N>
+using batch_fn = void (*)(const T* A, const T* B, T* C, std::size_t groups);
+
+template<typename T, std::size_t N>
+struct BatchKernel {
+    const char* name;
+    batch_fn<T, N> mul;
+};
+
+// Every batch kernel for N x N matrices the running CPU can execute, best
+// first, native_simd last.
+template<typename T, std::size_t N>
+std::vector<BatchKernel<T, N>> available_batch_kernels() {
+    std::vector<BatchKernel<T, N>> kernels;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const CpuFeatures& cpu = cpu_features();
+
+    if (cpu.avx512f)
+        kernels.push_back({"avx512", &avx512::mul_batch<T, N, avx512::GccVec<T, 64>>});
+    if (cpu.avx2 && cpu.fma)
+        kernels.push_back({"avx2", &avx2::mul_batch<T, N, avx2::GccVec<T, 32>>});
+    if (cpu.sse42)
+        kernels.push_back({"sse4.2", &sse42::mul_batch<T, N, sse42::GccVec<T, 16>>});
+#endif
+
+    kernels.push_back({"native", &mul_batch<T, N>});
+    return kernels;
+}
+
+template<typename T, std::size_t N>
+const BatchKernel<T, N>& best_batch_kernel() {
+    static const BatchKernel<T, N> kernel = available_batch_kernels<T, N>().front();
+    return kernel;
+}
+
+} // namespace gemm
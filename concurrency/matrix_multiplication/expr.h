@@ -0,0 +1,45 @@
+#pragma once
+
+// Lazy matrix expressions, so that
+//
+//     C = A * B;          C = A * B + D;          C += alpha * (A * B);
+//
+// become a single gemm(alpha, A, B, beta, C) call writing straight into C,
+// with no product temporary. The nodes hold references to their operands:
+// assign them in the same statement that builds them.
+namespace gemm {
+
+// alpha * A * B
+template<typename M>
+struct ProductExpr {
+    const M& a;
+    const M& b;
+    typename M::value_type alpha;
+};
+
+// alpha * A * B + beta * C
+template<typename M>
+struct GemmExpr {
+    const M& a;
+    const M& b;
+    typename M::value_type alpha;
+    const M& c;
+    typename M::value_type beta;
+};
+
+template<typename M>
+ProductExpr<M> operator*(typename M::value_type alpha, const ProductExpr<M>& product) {
+    return {product.a, product.b, alpha * product.alpha};
+}
+
+template<typename M>
+GemmExpr<M> operator+(const ProductExpr<M>& product, const M& addend) {
+    return {product.a, product.b, product.alpha, addend, typename M::value_type(1)};
+}
+
+template<typename M>
+GemmExpr<M> operator+(const M& addend, const ProductExpr<M>& product) {
+    return product + addend;
+}
+
+} // namespace gemm
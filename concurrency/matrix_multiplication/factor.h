@@ -0,0 +1,274 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tune.h"
+
+// Blocked right-looking factorisations of an n x n row-major matrix, in
+// place. Each step factors a `block` wide panel with the unblocked routine
+// and then updates the trailing matrix with gemm, so almost all the flops
+// run in the tiled SIMD kernel with its cache blocking:
+//
+//     [ A11     ]      A11 = L11 * L11^T          (cholesky_unblocked)
+//     [ A21 A22 ]      L21 = A21 * L11^-T         (rows split across the pool)
+//                      A22 -= L21 * L21^T         (column blocks across the pool)
+//
+// The unblocked routines double as the naive references, and the residual
+// functions check a factorisation against the matrix it came from.
+namespace gemm {
+
+constexpr std::size_t DEFAULT_FACTOR_BLOCK = 128;
+
+namespace detail {
+
+// Worker `worker`'s share [begin, end) of `count` items in contiguous runs.
+inline std::pair<std::size_t, std::size_t> split(std::size_t count, std::size_t worker, std::size_t worker_count) {
+    const std::size_t per_worker = (count + worker_count - 1) / worker_count;
+    const std::size_t begin = std::min(count, worker * per_worker);
+    return {begin, std::min(count, begin + per_worker)};
+}
+
+// Partially pivoted LU of columns [k, k + b) over rows [k, n). Each pivot
+// swaps the whole row, so the L already computed to the left and the
+// trailing columns to the right see the same permutation. pivots[j] is the
+// row swapped with row j, applied in order of j.
+template<typename T>
+void lu_panel(T* A, std::size_t lda, std::size_t n, std::size_t k, std::size_t b, std::size_t* pivots) {
+    for (std::size_t j = k; j < k + b; ++j) {
+        std::size_t p = j;
+        for (std::size_t i = j + 1; i < n; ++i)
+            if (std::abs(A[i*lda + j]) > std::abs(A[p*lda + j]))
+                p = i;
+
+        pivots[j] = p;
+        if (A[p*lda + j] == T(0))
+            throw std::domain_error("matrix is singular");
+
+        if (p != j)
+            std::swap_ranges(A + j*lda, A + j*lda + n, A + p*lda);
+
+        const T pivot = A[j*lda + j];
+        for (std::size_t i = j + 1; i < n; ++i) {
+            T* row = A + i*lda;
+            row[j] /= pivot;
+            for (std::size_t c = j + 1; c < k + b; ++c)
+                row[c] -= row[j] * A[j*lda + c];
+        }
+    }
+}
+
+} // namespace detail
+
+// Lower Cholesky factor of the symmetric positive definite A, written over
+// its lower triangle; the strict upper triangle is not touched. Throws
+// std::domain_error if A is not positive definite.
+template<typename T>
+void cholesky_unblocked(T* A, std::size_t lda, std::size_t n) {
+    static_assert(std::is_floating_point_v<T>, "factorisations need a floating-point type");
+
+    for (std::size_t j = 0; j < n; ++j) {
+        T* row_j = A + j*lda;
+
+        T d = row_j[j];
+        for (std::size_t c = 0; c < j; ++c)
+            d -= row_j[c] * row_j[c];
+        if (!(d > T(0)))
+            throw std::domain_error("matrix is not positive definite");
+        d = std::sqrt(d);
+        row_j[j] = d;
+
+        for (std::size_t i = j + 1; i < n; ++i) {
+            T* row_i = A + i*lda;
+            T sum = row_i[j];
+            for (std::size_t c = 0; c < j; ++c)
+                sum -= row_i[c] * row_j[c];
+            row_i[j] = sum / d;
+        }
+    }
+}
+
+// Partially pivoted LU: A = P^T * L * U with unit lower L and upper U
+// packed over A. pivots must hold n entries; see detail::lu_panel.
+// Throws std::domain_error on an exactly singular matrix.
+template<typename T>
+void lu_unblocked(T* A, std::size_t lda, std::size_t n, std::size_t* pivots) {
+    static_assert(std::is_floating_point_v<T>, "factorisations need a floating-point type");
+    detail::lu_panel(A, lda, n, 0, n, pivots);
+}
+
+// Blocked cholesky_unblocked. The trailing update only computes column
+// blocks on or below the diagonal, from a transposed copy of L21 so gemm
+// reads both operands row-major.
+template<typename T>
+void cholesky(
+    const Config<T>& config,
+    T* A, std::size_t lda, std::size_t n,
+    WorkerPool& pool,
+    std::size_t block = DEFAULT_FACTOR_BLOCK
+) {
+    static_assert(std::is_floating_point_v<T>, "factorisations need a floating-point type");
+
+    std::vector<T> transposed(block * n);
+
+    for (std::size_t k = 0; k < n; k += block) {
+        const std::size_t b = std::min(block, n - k);
+        T* A11 = A + k*lda + k;
+        cholesky_unblocked(A11, lda, b);
+
+        const std::size_t rest = n - k - b;
+        if (rest == 0)
+            break;
+
+        T* A21 = A11 + b*lda;
+        T* A22 = A21 + b;
+
+        // L21 = A21 * L11^-T, one forward substitution per row; the same
+        // pass writes L21^T for the update.
+        pool.run([&](std::size_t worker, std::size_t worker_count) {
+            const auto [begin, end] = detail::split(rest, worker, worker_count);
+            for (std::size_t i = begin; i < end; ++i) {
+                T* row = A21 + i*lda;
+                for (std::size_t j = 0; j < b; ++j) {
+                    T sum = row[j];
+                    for (std::size_t c = 0; c < j; ++c)
+                        sum -= row[c] * A11[j*lda + c];
+                    row[j] = sum / A11[j*lda + j];
+                    transposed[j*rest + i] = row[j];
+                }
+            }
+        });
+
+        // A22 -= L21 * L21^T, dealt out by block column; column block jb
+        // covers rows jb..rest of the trailing matrix.
+        const std::size_t column_blocks = (rest + block - 1) / block;
+        pool.run([&](std::size_t worker, std::size_t worker_count) {
+            for (std::size_t cb = worker; cb < column_blocks; cb += worker_count) {
+                const std::size_t jb = cb * block;
+                const std::size_t w = std::min(block, rest - jb);
+                gemm(
+                    config.kernel, config.blocking,
+                    T(-1),
+                    A21 + jb*lda, lda,
+                    transposed.data() + jb, rest,
+                    T(1),
+                    A22 + jb*lda + jb, lda,
+                    rest - jb, w, b
+                );
+            }
+        });
+    }
+}
+
+// Blocked lu_unblocked. U12 = L11^-1 * A12 is split by column across the
+// pool and A22 -= L21 * U12 goes through gemm_parallel.
+template<typename T>
+void lu(
+    const Config<T>& config,
+    T* A, std::size_t lda, std::size_t n,
+    std::size_t* pivots,
+    WorkerPool& pool,
+    std::size_t block = DEFAULT_FACTOR_BLOCK
+) {
+    static_assert(std::is_floating_point_v<T>, "factorisations need a floating-point type");
+
+    for (std::size_t k = 0; k < n; k += block) {
+        const std::size_t b = std::min(block, n - k);
+        detail::lu_panel(A, lda, n, k, b, pivots);
+
+        const std::size_t rest = n - k - b;
+        if (rest == 0)
+            break;
+
+        const T* L11 = A + k*lda + k;
+        T* A12 = A + k*lda + k + b;
+        const T* L21 = A + (k + b)*lda + k;
+        T* A22 = A + (k + b)*lda + k + b;
+
+        // Row r of U12 loses L11[r][c] times each earlier row c.
+        pool.run([&](std::size_t worker, std::size_t worker_count) {
+            const auto [begin, end] = detail::split(rest, worker, worker_count);
+            for (std::size_t r = 1; r < b; ++r)
+                for (std::size_t c = 0; c < r; ++c) {
+                    const T l = L11[r*lda + c];
+                    for (std::size_t j = begin; j < end; ++j)
+                        A12[r*lda + j] -= l * A12[c*lda + j];
+                }
+        });
+
+        gemm_parallel(
+            config.kernel, config.blocking,
+            T(-1), L21, lda, A12, lda,
+            T(1), A22, lda,
+            rest, rest, b, pool
+        );
+    }
+}
+
+template<typename T>
+void cholesky(T* A, std::size_t lda, std::size_t n, WorkerPool& pool, std::size_t block = DEFAULT_FACTOR_BLOCK) {
+    cholesky(active_config<T>(), A, lda, n, pool, block);
+}
+
+template<typename T>
+void lu(T* A, std::size_t lda, std::size_t n, std::size_t* pivots, WorkerPool& pool, std::size_t block = DEFAULT_FACTOR_BLOCK) {
+    lu(active_config<T>(), A, lda, n, pivots, pool, block);
+}
+
+// ||A - L * L^T||_F / ||A||_F with the naive triple loop, reading only the
+// lower triangle of L.
+template<typename T>
+double cholesky_residual(const T* A, std::size_t lda, const T* L, std::size_t ldl, std::size_t n) {
+    double error = 0;
+    double norm = 0;
+
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            double sum = 0;
+            for (std::size_t c = 0; c <= std::min(i, j); ++c)
+                sum += double(L[i*ldl + c]) * double(L[j*ldl + c]);
+
+            const double a = A[i*lda + j];
+            error += (a - sum) * (a - sum);
+            norm += a * a;
+        }
+
+    return std::sqrt(error / norm);
+}
+
+// ||P * A - L * U||_F / ||A||_F for the packed factors lu() leaves behind.
+template<typename T>
+double lu_residual(
+    const T* A, std::size_t lda,
+    const T* LU, std::size_t ldlu,
+    const std::size_t* pivots, std::size_t n
+) {
+    std::vector<std::size_t> rows(n);
+    for (std::size_t i = 0; i < n; ++i)
+        rows[i] = i;
+    for (std::size_t j = 0; j < n; ++j)
+        std::swap(rows[j], rows[pivots[j]]);
+
+    double error = 0;
+    double norm = 0;
+
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t j = 0; j < n; ++j) {
+            double sum = i <= j ? double(LU[i*ldlu + j]) : 0.0;
+            for (std::size_t c = 0; c < std::min(i, j + 1); ++c)
+                sum += double(LU[i*ldlu + c]) * double(LU[c*ldlu + j]);
+
+            const double a = A[rows[i]*lda + j];
+            error += (a - sum) * (a - sum);
+            norm += a * a;
+        }
+
+    return std::sqrt(error / norm);
+}
+
+} // namespace gemm
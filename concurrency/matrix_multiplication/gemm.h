@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <experimental/simd>
+
+#include "pool.h"
+
+namespace stdx = std::experimental;
+
+// Tiled SIMD multiply shared by SquareMatrix and Matrix. Everything works on
+// raw row-major pointers plus a leading dimension (elements per row), so the
+// same code serves compile-time and runtime sized matrices, and sub-blocks of
+// either.
+//
+//     C[M x N] += A[M x K] * B[K x N]
+//
+// C is cut into MC x NC output tiles and K into KC slices. Operand panels
+// are copied into contiguous packs as the kk loop reaches them (BLIS style):
+// A MR rows at a time, B one KC x NC block per kk, so neither operand needs
+// a pre-transposed copy.
+namespace gemm {
+
+// Cache blocking, chosen at runtime so the autotuner can fit it to the
+// host's caches.
+struct Blocking {
+    std::size_t mc;
+    std::size_t kc;
+    std::size_t nc;
+};
+
+constexpr Blocking DEFAULT_BLOCKING{32, 32, 32};
+
+// Largest MR any kernel may use, which sizes the A pack buffers.
+constexpr std::size_t MAX_MR = 8;
+
+template<typename T>
+constexpr std::size_t SIMD_WIDTH = stdx::native_simd<T>::size();
+
+// Vector policies the microkernel is written against. NativeVec is
+// std::experimental's native_simd, whose width is fixed by the -march the
+// build targets. GccVec (in tile.inl) is a plain GCC vector of a given byte
+// width, which is generated for whatever target the code around it is
+// compiled for. Vectors are passed by reference only, so no function
+// signature depends on the vector calling convention of a particular ISA.
+template<typename T>
+struct NativeVec {
+    using type = stdx::native_simd<T>;
+    constexpr static std::size_t width = type::size();
+
+    static void load(type& v, const T* p) { v.copy_from(p, stdx::vector_aligned); }
+    static void loadu(type& v, const T* p) { v.copy_from(p, stdx::element_aligned); }
+    static void broadcast(type& v, T x) { v = type(x); }
+    static void storeu(T* p, const type& v) { v.copy_to(p, stdx::element_aligned); }
+};
+
+// Default micro-tile: MR rows of A against one SIMD vector of B columns.
+template<typename T>
+constexpr std::size_t DEFAULT_MR = 4;
+
+template<typename T>
+constexpr std::size_t DEFAULT_NR = SIMD_WIDTH<T>;
+
+// Matrices per group in the batch layout: one 64-byte line per element.
+template<typename T>
+constexpr std::size_t BATCH_LANES = 64 / sizeof(T);
+
+template<typename T>
+using tile_fn = void (*)(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t ii, std::size_t i_end,
+    std::size_t jj, std::size_t j_end,
+    std::size_t K, std::size_t kc,
+    T alpha, T beta,
+    T* A_pack, T* B_pack
+);
+
+// One compiled mul_tile instantiation plus the ISA and micro-tile shape it
+// was built with.
+template<typename T>
+struct Kernel {
+    const char* name;
+    std::size_t mr;
+    std::size_t nr;
+    tile_fn<T> tile;
+};
+
+template<typename T, std::size_t MR, std::size_t NR>
+constexpr Kernel<T> make_kernel(const char* name, tile_fn<T> tile) {
+    static_assert(MR <= MAX_MR);
+    return Kernel<T>{name, MR, NR, tile};
+}
+
+#include "tile.inl"
+
+constexpr std::size_t round_up(std::size_t value, std::size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+template<typename T>
+struct Packs {
+    T* a;
+    T* b;
+};
+
+// Per-thread scratch for the packs. It only grows, so the pool workers and
+// repeated small multiplies do not allocate on every call. 64B aligned for
+// the vector loads of the packs.
+inline void* thread_buffer(std::size_t bytes) {
+    struct Storage {
+        void* data = nullptr;
+        std::size_t bytes = 0;
+        ~Storage() { std::free(data); }
+    };
+    thread_local Storage storage;
+
+    if (storage.bytes < bytes) {
+        void* mem = std::aligned_alloc(64, round_up(bytes, 64));
+        if (mem == nullptr)
+            throw std::bad_alloc();
+        std::free(storage.data);
+        storage.data = mem;
+        storage.bytes = bytes;
+    }
+
+    return storage.data;
+}
+
+// Pack buffers sized for a kernel and blocking.
+template<typename T>
+Packs<T> thread_packs(const Kernel<T>& kernel, const Blocking& blocking) {
+    const std::size_t a_bytes = round_up(MAX_MR * blocking.kc * sizeof(T), 64);
+    const std::size_t b_bytes = round_up(blocking.kc * round_up(blocking.nc, kernel.nr) * sizeof(T), 64);
+
+    T* base = static_cast<T*>(thread_buffer(a_bytes + b_bytes));
+    return Packs<T>{base, base + a_bytes / sizeof(T)};
+}
+
+// C = alpha * A * B + beta * C, in place. beta is applied to each C tile
+// right before it is accumulated into, while it is in cache, so there is no
+// separate pass over C; beta == 0 never reads C.
+template<typename T>
+void gemm(
+    const Kernel<T>& kernel, const Blocking& blocking,
+    T alpha,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T beta,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K
+) {
+    const Packs<T> packs = thread_packs(kernel, blocking);
+
+    for (std::size_t ii = 0; ii < M; ii += blocking.mc)
+        for (std::size_t jj = 0; jj < N; jj += blocking.nc)
+            kernel.tile(
+                A, lda, B, ldb, C, ldc,
+                ii, std::min(ii + blocking.mc, M),
+                jj, std::min(jj + blocking.nc, N),
+                K, blocking.kc, alpha, beta, packs.a, packs.b
+            );
+}
+
+// Same tiling as gemm, but the (ii, jj) output tiles are dealt out
+// round-robin to the pool's workers. Each C tile is owned by exactly one
+// worker and accumulated over kk in the same order as gemm, so the
+// product is identical to the single threaded one.
+template<typename T>
+void gemm_parallel(
+    const Kernel<T>& kernel, const Blocking& blocking,
+    T alpha,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T beta,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K,
+    WorkerPool& pool
+) {
+    const std::size_t row_tiles = (M + blocking.mc - 1) / blocking.mc;
+    const std::size_t col_tiles = (N + blocking.nc - 1) / blocking.nc;
+
+    pool.run([&](std::size_t worker, std::size_t worker_count) {
+        const Packs<T> packs = thread_packs(kernel, blocking);
+
+        for (std::size_t tile = worker; tile < row_tiles * col_tiles; tile += worker_count) {
+            const std::size_t ii = (tile / col_tiles) * blocking.mc;
+            const std::size_t jj = (tile % col_tiles) * blocking.nc;
+            kernel.tile(
+                A, lda, B, ldb, C, ldc,
+                ii, std::min(ii + blocking.mc, M),
+                jj, std::min(jj + blocking.nc, N),
+                K, blocking.kc, alpha, beta, packs.a, packs.b
+            );
+        }
+    });
+}
+
+// C += A * B.
+template<typename T>
+void multiply(
+    const Kernel<T>& kernel, const Blocking& blocking,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K
+) {
+    gemm(kernel, blocking, T(1), A, lda, B, ldb, T(1), C, ldc, M, N, K);
+}
+
+template<typename T>
+void multiply_parallel(
+    const Kernel<T>& kernel, const Blocking& blocking,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K,
+    WorkerPool& pool
+) {
+    gemm_parallel(kernel, blocking, T(1), A, lda, B, ldb, T(1), C, ldc, M, N, K, pool);
+}
+
+} // namespace gemm
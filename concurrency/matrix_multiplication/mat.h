@@ -1,21 +1,19 @@
 #pragma once
 
 #include <array>
-#include <random>
 #include <print>
+#include <type_traits>
 
-#include <experimental/simd>
-
-namespace stdx = std::experimental;
+#include "expr.h"
+#include "factor.h"
+#include "rng.h"
+#include "tune.h"
 
 template<typename T, std::size_t N>
 class alignas(stdx::memory_alignment_v<stdx::native_simd<T>>) SquareMatrix {
 private:
 
-    using simd_t = stdx::native_simd<T>;
-
     std::array<T, N*N> matrix_;
-    std::array<T, N*N> transposed_;
 
     constexpr static inline std::size_t getIndex(std::size_t x, std::size_t y) {
         return y * N + x;
@@ -23,29 +21,41 @@ private:
 
 public:
 
-    SquareMatrix()
-        : matrix_{0}
-        , transposed_{0} {}
+    using value_type = T;
 
-    static SquareMatrix make_random(T lower_bound, T upper_bound) {
-        thread_local std::random_device rd; 
-        thread_local std::mt19937 gen(rd()); 
-        std::uniform_int_distribution<> distrib(lower_bound, upper_bound); 
+    constexpr SquareMatrix()
+        : matrix_{0} {}
 
-        SquareMatrix random_matrix;
-        for (std::size_t i = 0; i < N*N; ++i) 
-            random_matrix.matrix_[i] = distrib(gen);
+    // Row-major elements, for matrices spelled out in the source.
+    constexpr explicit SquareMatrix(const std::array<T, N*N>& elements)
+        : matrix_(elements) {}
 
-        for (std::size_t y = 0; y < N; ++y) {
-            for (std::size_t x = 0; x <= y; ++x) {
-                random_matrix.transposed_[getIndex(x,y)] = random_matrix.matrix_[getIndex(y,x)];
-                random_matrix.transposed_[getIndex(y,x)] = random_matrix.matrix_[getIndex(x,y)];
-            }
-        }
+    constexpr static SquareMatrix identity() {
+        SquareMatrix result;
+        for (std::size_t i = 0; i < N; ++i)
+            result.matrix_[getIndex(i, i)] = T(1);
+        return result;
+    }
 
+    // Integers uniform in [lower_bound, upper_bound] from Philox stream
+    // `seed`; the same seed always gives the same matrix.
+    static SquareMatrix make_random(T lower_bound, T upper_bound, std::uint64_t seed = rng::next_seed()) {
+        SquareMatrix random_matrix;
+        rng::fill_uniform(random_matrix.matrix_.data(), N*N, lower_bound, upper_bound, seed);
         return random_matrix;
     }
 
+    T* data() { return matrix_.data(); }
+    const T* data() const { return matrix_.data(); }
+
+    constexpr T& operator()(std::size_t row, std::size_t col) {
+        return matrix_[getIndex(col, row)];
+    }
+
+    constexpr const T& operator()(std::size_t row, std::size_t col) const {
+        return matrix_[getIndex(col, row)];
+    }
+
     void print() const {
         for (std::size_t y = 0; y < N; ++y) {
             for (std::size_t x = 0; x < N; ++x) {
@@ -70,138 +80,149 @@ public:
         return product;
     }
 
-    SquareMatrix mul_simd(const SquareMatrix& other) const {
-        SquareMatrix product{};
-
-        constexpr std::size_t TILE_SIZE = 32;
-        constexpr std::size_t NR = 4;
-
-        const T* A = matrix_.data();
-        const T* BT = other.transposed_.data();
-        T* C = product.matrix_.data();
-
-        alignas(64) T A_pack[NR * TILE_SIZE];
-        alignas(64) T B_pack[NR * TILE_SIZE];
-
-        for (std::size_t ii = 0; ii < N; ii += TILE_SIZE) {
-            for (std::size_t jj = 0; jj < N; jj += TILE_SIZE) {
-                for (std::size_t kk = 0; kk < N; kk += TILE_SIZE) {
-                    
-                    const std::size_t i_end = std::min(ii + TILE_SIZE, N);
-                    const std::size_t j_end = std::min(jj + TILE_SIZE, N);
-                    const std::size_t k_end = std::min(kk + TILE_SIZE, N);
-
-                    const std::size_t K_blk  = k_end - kk;
+    // Up to this size mul_simd skips the tile loops for mul_unrolled.
+    constexpr static std::size_t UNROLL_MAX_N = 8;
 
-                    for (std::size_t i = ii; i < i_end; i += NR) {
+    // The whole product as straight-line code, chosen at compile time by N.
+    // 2x2 fits one four-lane vector: C = [a00 a00 a10 a10] * [b00 b01 b00 b01]
+    //                                  + [a01 a01 a11 a11] * [b10 b11 b10 b11].
+    // Larger sizes hold each row of B in an N-lane vector and build row i
+    // of C from N broadcasts of row i of A, unrolled over i and k. Usable
+    // in constant expressions, where it falls back to scalar loops.
+    constexpr SquareMatrix mul_unrolled(const SquareMatrix& other) const {
+        static_assert(N <= UNROLL_MAX_N, "mul_unrolled is meant for N <= 8");
 
-                        const T* A0 = A + (i+0)*N + kk;
-                        const T* A1 = A + (i+1)*N + kk;
-                        const T* A2 = A + (i+2)*N + kk;
-                        const T* A3 = A + (i+3)*N + kk;
-
-                        pack_tiles(A0, A1, A2, A3, A_pack, K_blk);
-
-                        for (std::size_t j = jj; j < j_end; j += NR) {
-                            const T* B0 = BT + (j+0)*N + kk;
-                            const T* B1 = BT + (j+1)*N + kk;
-                            const T* B2 = BT + (j+2)*N + kk;
-                            const T* B3 = BT + (j+3)*N + kk;
-
-                            pack_tiles(B0, B1, B2, B3, B_pack, K_blk);
-                                
-                            T* C0 = C + (i+0)*N + j;
-                            T* C1 = C + (i+1)*N + j;
-                            T* C2 = C + (i+2)*N + j;
-                            T* C3 = C + (i+3)*N + j;
+        SquareMatrix product;
 
-                            microkernel_4x4(
-                                A_pack, B_pack, 
-                                C0, C1, C2, C3,
-                                K_blk
-                            );
+        if (std::is_constant_evaluated()) {
+            for (std::size_t y = 0; y < N; ++y)
+                for (std::size_t x = 0; x < N; ++x)
+                    for (std::size_t k = 0; k < N; ++k)
+                        product.matrix_[getIndex(x, y)] += matrix_[getIndex(k, y)] * other.matrix_[getIndex(x, k)];
+            return product;
+        }
 
-                        }
-                    }
-                }
+        if constexpr (N == 2) {
+            using simd_t = stdx::fixed_size_simd<T, 4>;
+            const T* a = matrix_.data();
+            const T* b = other.matrix_.data();
+
+            const simd_t a0([a](auto i) { return a[i / 2 * 2]; });
+            const simd_t a1([a](auto i) { return a[i / 2 * 2 + 1]; });
+            const simd_t b0([b](auto i) { return b[i % 2]; });
+            const simd_t b1([b](auto i) { return b[2 + i % 2]; });
+
+            (a0 * b0 + a1 * b1).copy_to(product.matrix_.data(), stdx::element_aligned);
+        } else {
+            using simd_t = stdx::fixed_size_simd<T, N>;
+
+            simd_t b[N];
+            #pragma GCC unroll 8
+            for (std::size_t k = 0; k < N; ++k)
+                b[k].copy_from(other.matrix_.data() + k*N, stdx::element_aligned);
+
+            #pragma GCC unroll 8
+            for (std::size_t y = 0; y < N; ++y) {
+                simd_t row = simd_t(matrix_[getIndex(0, y)]) * b[0];
+                #pragma GCC unroll 8
+                for (std::size_t k = 1; k < N; ++k)
+                    row += simd_t(matrix_[getIndex(k, y)]) * b[k];
+                row.copy_to(product.matrix_.data() + y*N, stdx::element_aligned);
             }
         }
 
+        return product;
+    }
 
+    // The tiled gemm path for every N.
+    SquareMatrix mul_tiled(const SquareMatrix& other) const {
+        SquareMatrix product{};
+        gemm::multiply(
+            matrix_.data(), N,
+            other.matrix_.data(), N,
+            product.matrix_.data(), N,
+            N, N, N
+        );
         return product;
     }
 
-    bool operator==(const SquareMatrix& other) const {
-        for (std::size_t i = 0; i < N*N; ++i)
-            if (matrix_[i] != other.matrix_[i])
-                return false;
-        return true;
+    SquareMatrix mul_simd(const SquareMatrix& other) const {
+        if constexpr (N <= UNROLL_MAX_N)
+            return mul_unrolled(other);
+        else
+            return mul_tiled(other);
     }
 
-private:
+    SquareMatrix mul_parallel(const SquareMatrix& other, WorkerPool& pool) const {
+        SquareMatrix product{};
+        gemm::multiply_parallel(
+            matrix_.data(), N,
+            other.matrix_.data(), N,
+            product.matrix_.data(), N,
+            N, N, N, pool
+        );
+        return product;
+    }
 
-    void pack_tiles(
-        const T* R0, const T* R1, const T* R2, const T* R3,
-        T* pack, std::size_t K_blk
-    ) const {
-        for (std::size_t k = 0; k < K_blk; ++k) {
-            pack[0*K_blk + k] = R0[k];
-            pack[1*K_blk + k] = R1[k];
-            pack[2*K_blk + k] = R2[k];
-            pack[3*K_blk + k] = R3[k];
-        }
+    // Lower triangular L with L * L^T == *this, for a symmetric positive
+    // definite floating-point matrix; see gemm::cholesky.
+    SquareMatrix cholesky(WorkerPool& pool, std::size_t block = gemm::DEFAULT_FACTOR_BLOCK) const {
+        SquareMatrix factor(*this);
+        gemm::cholesky(factor.matrix_.data(), N, N, pool, block);
+
+        for (std::size_t y = 0; y < N; ++y)
+            for (std::size_t x = y + 1; x < N; ++x)
+                factor.matrix_[getIndex(x, y)] = T(0);
+        return factor;
+    }
+
+    // Unit lower L (diagonal not stored) and U packed in one matrix, with
+    // P * this == L * U for the row swaps in pivots; see gemm::lu.
+    SquareMatrix lu(std::array<std::size_t, N>& pivots, WorkerPool& pool, std::size_t block = gemm::DEFAULT_FACTOR_BLOCK) const {
+        SquareMatrix factors(*this);
+        gemm::lu(factors.matrix_.data(), N, N, pivots.data(), pool, block);
+        return factors;
     }
 
-    void microkernel_4x4(
-        const T* A_pack,
-        const T* B_pack,
-        T* C0, T* C1, T* C2, T* C3,
-        std::size_t K_blk
-    ) const {
-        simd_t c00(0), c01(0), c02(0), c03(0);
-        simd_t c10(0), c11(0), c12(0), c13(0);
-        simd_t c20(0), c21(0), c22(0), c23(0);
-        simd_t c30(0), c31(0), c32(0), c33(0);
-
-        const std::size_t K_simd = (K_blk / simd_t::size()) * simd_t::size();
-        for (std::size_t k = 0; k < K_simd; k += simd_t::size()) {
-            simd_t a0, a1, a2, a3;
-            a0.copy_from(A_pack + 0*K_blk + k, stdx::vector_aligned);
-            a1.copy_from(A_pack + 1*K_blk + k, stdx::vector_aligned);
-            a2.copy_from(A_pack + 2*K_blk + k, stdx::vector_aligned);
-            a3.copy_from(A_pack + 3*K_blk + k, stdx::vector_aligned);
-
-            simd_t b0, b1, b2, b3;
-            b0.copy_from(B_pack + 0*K_blk + k, stdx::vector_aligned);
-            b1.copy_from(B_pack + 1*K_blk + k, stdx::vector_aligned);
-            b2.copy_from(B_pack + 2*K_blk + k, stdx::vector_aligned);
-            b3.copy_from(B_pack + 3*K_blk + k, stdx::vector_aligned);
-
-            c00 += a0 * b0; c01 += a0 * b1; c02 += a0 * b2; c03 += a0 * b3;
-            c10 += a1 * b0; c11 += a1 * b1; c12 += a1 * b2; c13 += a1 * b3;
-            c20 += a2 * b0; c21 += a2 * b1; c22 += a2 * b2; c23 += a2 * b3;
-            c30 += a3 * b0; c31 += a3 * b1; c32 += a3 * b2; c33 += a3 * b3;
+    friend gemm::ProductExpr<SquareMatrix> operator*(const SquareMatrix& a, const SquareMatrix& b) {
+        return {a, b, T(1)};
+    }
+
+    // C = alpha * A * B + beta * D in place, through gemm::gemm.
+    SquareMatrix& operator=(const gemm::GemmExpr<SquareMatrix>& expr) {
+        // The kernel would overwrite an operand it is still reading.
+        if (this == &expr.a || this == &expr.b) {
+            SquareMatrix result;
+            result = expr;
+            return *this = result;
         }
 
-        C0[0] += c00[0] + c00[1] + c00[2] + c00[3];
-        C0[1] += c01[0] + c01[1] + c01[2] + c01[3];
-        C0[2] += c02[0] + c02[1] + c02[2] + c02[3];
-        C0[3] += c03[0] + c03[1] + c03[2] + c03[3];
+        if (this != &expr.c && expr.beta != T(0))
+            matrix_ = expr.c.matrix_;
+
+        gemm::gemm(
+            expr.alpha,
+            expr.a.matrix_.data(), N,
+            expr.b.matrix_.data(), N,
+            expr.beta,
+            matrix_.data(), N,
+            N, N, N
+        );
+        return *this;
+    }
 
-        C1[0] += c10[0] + c10[1] + c10[2] + c10[3];
-        C1[1] += c11[0] + c11[1] + c11[2] + c11[3];
-        C1[2] += c12[0] + c12[1] + c12[2] + c12[3];
-        C1[3] += c13[0] + c13[1] + c13[2] + c13[3];
+    SquareMatrix& operator=(const gemm::ProductExpr<SquareMatrix>& expr) {
+        return *this = gemm::GemmExpr<SquareMatrix>{expr.a, expr.b, expr.alpha, *this, T(0)};
+    }
 
-        C2[0] += c20[0] + c20[1] + c20[2] + c20[3];
-        C2[1] += c21[0] + c21[1] + c21[2] + c21[3];
-        C2[2] += c22[0] + c22[1] + c22[2] + c22[3];
-        C2[3] += c23[0] + c23[1] + c23[2] + c23[3];
+    SquareMatrix& operator+=(const gemm::ProductExpr<SquareMatrix>& expr) {
+        return *this = gemm::GemmExpr<SquareMatrix>{expr.a, expr.b, expr.alpha, *this, T(1)};
+    }
 
-        C3[0] += c30[0] + c30[1] + c30[2] + c30[3];
-        C3[1] += c31[0] + c31[1] + c31[2] + c31[3];
-        C3[2] += c32[0] + c32[1] + c32[2] + c32[3];
-        C3[3] += c33[0] + c33[1] + c33[2] + c33[3];
+    constexpr bool operator==(const SquareMatrix& other) const {
+        for (std::size_t i = 0; i < N*N; ++i)
+            if (matrix_[i] != other.matrix_[i])
+                return false;
+        return true;
     }
 };
-
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <print>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "expr.h"
+#include "factor.h"
+#include "recursive.h"
+#include "rng.h"
+
+enum class Backing {
+    Regular,    // aligned_alloc on regular pages
+    HugePages,  // MAP_HUGETLB 2MB pages, falling back to transparent huge pages
+};
+
+// Row-major matrix whose dimensions are chosen at runtime. Storage lives on
+// the heap, aligned to a cache line, so large operands no longer have to fit
+// on the stack the way SquareMatrix does.
+template<typename T>
+class Matrix {
+private:
+
+    constexpr static std::size_t ALIGNMENT = 64;
+    constexpr static std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    Backing backing_ = Backing::Regular;
+
+    T* data_ = nullptr;
+    std::size_t mapped_bytes_ = 0; // non-zero when data_ came from mmap
+
+    constexpr static std::size_t round_up(std::size_t value, std::size_t multiple) {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    void allocate() {
+        const std::size_t bytes = rows_ * cols_ * sizeof(T);
+        if (bytes == 0)
+            return;
+
+        if (backing_ == Backing::HugePages) {
+            const std::size_t mapped = round_up(bytes, HUGE_PAGE_SIZE);
+
+            void* mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+            // No reserved hugetlbfs pages, ask for THP instead.
+            if (mem == MAP_FAILED) {
+                mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mem == MAP_FAILED)
+                    throw std::bad_alloc();
+                madvise(mem, mapped, MADV_HUGEPAGE);
+            }
+
+            // Anonymous mappings are already zeroed.
+            data_ = static_cast<T*>(mem);
+            mapped_bytes_ = mapped;
+            return;
+        }
+
+        void* mem = std::aligned_alloc(ALIGNMENT, round_up(bytes, ALIGNMENT));
+        if (mem == nullptr)
+            throw std::bad_alloc();
+
+        std::memset(mem, 0, bytes);
+        data_ = static_cast<T*>(mem);
+    }
+
+    void release() noexcept {
+        if (data_ == nullptr)
+            return;
+
+        if (mapped_bytes_ != 0)
+            munmap(data_, mapped_bytes_);
+        else
+            std::free(data_);
+
+        data_ = nullptr;
+        mapped_bytes_ = 0;
+    }
+
+public:
+
+    using value_type = T;
+
+    Matrix() = default;
+
+    Matrix(std::size_t rows, std::size_t cols, Backing backing = Backing::Regular)
+        : rows_(rows)
+        , cols_(cols)
+        , backing_(backing) {
+        allocate();
+    }
+
+    ~Matrix() {
+        release();
+    }
+
+    Matrix(const Matrix& other)
+        : Matrix(other.rows_, other.cols_, other.backing_) {
+        if (data_ != nullptr)
+            std::memcpy(data_, other.data_, rows_ * cols_ * sizeof(T));
+    }
+
+    Matrix& operator=(const Matrix& other) {
+        if (this == &other)
+            return *this;
+
+        Matrix copy(other);
+        *this = std::move(copy);
+        return *this;
+    }
+
+    Matrix(Matrix&& other) noexcept
+        : rows_(std::exchange(other.rows_, 0))
+        , cols_(std::exchange(other.cols_, 0))
+        , backing_(other.backing_)
+        , data_(std::exchange(other.data_, nullptr))
+        , mapped_bytes_(std::exchange(other.mapped_bytes_, 0)) {}
+
+    Matrix& operator=(Matrix&& other) noexcept {
+        if (this == &other)
+            return *this;
+
+        release();
+        rows_ = std::exchange(other.rows_, 0);
+        cols_ = std::exchange(other.cols_, 0);
+        backing_ = other.backing_;
+        data_ = std::exchange(other.data_, nullptr);
+        mapped_bytes_ = std::exchange(other.mapped_bytes_, 0);
+
+        return *this;
+    }
+
+    // Integers uniform in [lower_bound, upper_bound] from Philox stream
+    // `seed`; the same seed always gives the same matrix.
+    static Matrix make_random(
+        std::size_t rows, std::size_t cols,
+        T lower_bound, T upper_bound,
+        Backing backing = Backing::Regular,
+        std::uint64_t seed = rng::next_seed()
+    ) {
+        Matrix random_matrix(rows, cols, backing);
+        rng::fill_uniform(random_matrix.data_, rows * cols, lower_bound, upper_bound, seed);
+        return random_matrix;
+    }
+
+    // make_random filled by every worker in the pool; the result is the
+    // same as the serial fill for the same seed.
+    static Matrix make_random(
+        std::size_t rows, std::size_t cols,
+        T lower_bound, T upper_bound,
+        WorkerPool& pool,
+        Backing backing = Backing::Regular,
+        std::uint64_t seed = rng::next_seed()
+    ) {
+        Matrix random_matrix(rows, cols, backing);
+        rng::fill_uniform_parallel(random_matrix.data_, rows * cols, lower_bound, upper_bound, seed, pool);
+        return random_matrix;
+    }
+
+    std::size_t rows() const { return rows_; }
+    std::size_t cols() const { return cols_; }
+    Backing backing() const { return backing_; }
+
+    T* data() { return data_; }
+    const T* data() const { return data_; }
+
+    T& operator()(std::size_t row, std::size_t col) {
+        return data_[row * cols_ + col];
+    }
+
+    const T& operator()(std::size_t row, std::size_t col) const {
+        return data_[row * cols_ + col];
+    }
+
+    void print() const {
+        for (std::size_t y = 0; y < rows_; ++y) {
+            for (std::size_t x = 0; x < cols_; ++x) {
+                std::print("{:8} ", (*this)(y, x));
+            }
+            std::println();
+        }
+    }
+
+    Matrix mul_naive(const Matrix& other) const {
+        if (cols_ != other.rows_)
+            throw std::invalid_argument("inner dimensions do not match");
+
+        Matrix product(rows_, other.cols_, backing_);
+
+        for (std::size_t y = 0; y < rows_; ++y) {
+            for (std::size_t x = 0; x < other.cols_; ++x) {
+                for (std::size_t k = 0; k < cols_; ++k) {
+                    product(y, x) += (*this)(y, k) * other(k, x);
+                }
+            }
+        }
+
+        return product;
+    }
+
+    Matrix mul_simd(const Matrix& other) const {
+        if (cols_ != other.rows_)
+            throw std::invalid_argument("inner dimensions do not match");
+
+        Matrix product(rows_, other.cols_, backing_);
+        gemm::multiply(
+            data_, cols_,
+            other.data_, other.cols_,
+            product.data_, product.cols_,
+            rows_, other.cols_, cols_
+        );
+        return product;
+    }
+
+    Matrix mul_parallel(const Matrix& other, WorkerPool& pool) const {
+        if (cols_ != other.rows_)
+            throw std::invalid_argument("inner dimensions do not match");
+
+        Matrix product(rows_, other.cols_, backing_);
+        gemm::multiply_parallel(
+            data_, cols_,
+            other.data_, other.cols_,
+            product.data_, product.cols_,
+            rows_, other.cols_, cols_,
+            pool
+        );
+        return product;
+    }
+
+    // Divide and conquer multiply for operands too large for mul_simd's tile
+    // loop to stay in cache; see gemm::multiply_recursive.
+    Matrix mul_recursive(const Matrix& other, std::size_t leaf = gemm::DEFAULT_LEAF) const {
+        if (cols_ != other.rows_)
+            throw std::invalid_argument("inner dimensions do not match");
+
+        Matrix product(rows_, other.cols_, backing_);
+        gemm::multiply_recursive(
+            gemm::active_config<T>(),
+            data_, cols_,
+            other.data_, other.cols_,
+            product.data_, product.cols_,
+            rows_, other.cols_, cols_,
+            leaf
+        );
+        return product;
+    }
+
+    // mul_recursive with `levels` Strassen-Winograd steps on top; see
+    // gemm::multiply_strassen.
+    Matrix mul_strassen(
+        const Matrix& other,
+        std::size_t leaf = gemm::DEFAULT_LEAF,
+        std::size_t levels = 1
+    ) const {
+        if (cols_ != other.rows_)
+            throw std::invalid_argument("inner dimensions do not match");
+
+        Matrix product(rows_, other.cols_, backing_);
+        gemm::multiply_strassen(
+            gemm::active_config<T>(),
+            data_, cols_,
+            other.data_, other.cols_,
+            product.data_, product.cols_,
+            rows_, other.cols_, cols_,
+            leaf, levels
+        );
+        return product;
+    }
+
+    // Lower triangular L with L * L^T == *this, for a symmetric positive
+    // definite floating-point matrix; see gemm::cholesky.
+    Matrix cholesky(WorkerPool& pool, std::size_t block = gemm::DEFAULT_FACTOR_BLOCK) const {
+        if (rows_ != cols_)
+            throw std::invalid_argument("matrix is not square");
+
+        Matrix factor(*this);
+        gemm::cholesky(factor.data_, cols_, rows_, pool, block);
+
+        for (std::size_t y = 0; y < rows_; ++y)
+            std::fill(factor.data_ + y*cols_ + y + 1, factor.data_ + (y + 1)*cols_, T(0));
+        return factor;
+    }
+
+    // Unit lower L (diagonal not stored) and U packed in one matrix, with
+    // P * this == L * U for the row swaps in pivots; see gemm::lu.
+    Matrix lu(std::vector<std::size_t>& pivots, WorkerPool& pool, std::size_t block = gemm::DEFAULT_FACTOR_BLOCK) const {
+        if (rows_ != cols_)
+            throw std::invalid_argument("matrix is not square");
+
+        Matrix factors(*this);
+        pivots.resize(rows_);
+        gemm::lu(factors.data_, cols_, rows_, pivots.data(), pool, block);
+        return factors;
+    }
+
+    friend gemm::ProductExpr<Matrix> operator*(const Matrix& a, const Matrix& b) {
+        return {a, b, T(1)};
+    }
+
+    // C = alpha * A * B + beta * D in place, through gemm::gemm. C is only
+    // reallocated when its shape differs from the product's.
+    Matrix& operator=(const gemm::GemmExpr<Matrix>& expr) {
+        const Matrix& a = expr.a;
+        const Matrix& b = expr.b;
+        const Matrix& c = expr.c;
+
+        if (a.cols_ != b.rows_)
+            throw std::invalid_argument("inner dimensions do not match");
+        if (expr.beta != T(0) && (c.rows_ != a.rows_ || c.cols_ != b.cols_))
+            throw std::invalid_argument("addend dimensions do not match");
+
+        // The kernel would overwrite an operand it is still reading. The
+        // temporary takes this matrix's backing, which the move keeps.
+        if (this == &a || this == &b) {
+            Matrix result(a.rows_, b.cols_, backing_);
+            result = expr;
+            return *this = std::move(result);
+        }
+
+        if (rows_ != a.rows_ || cols_ != b.cols_)
+            *this = Matrix(a.rows_, b.cols_, backing_);
+
+        if (this != &c && expr.beta != T(0) && data_ != nullptr)
+            std::memcpy(data_, c.data_, rows_ * cols_ * sizeof(T));
+
+        gemm::gemm(
+            expr.alpha,
+            a.data_, a.cols_,
+            b.data_, b.cols_,
+            expr.beta,
+            data_, cols_,
+            a.rows_, b.cols_, a.cols_
+        );
+        return *this;
+    }
+
+    Matrix& operator=(const gemm::ProductExpr<Matrix>& expr) {
+        return *this = gemm::GemmExpr<Matrix>{expr.a, expr.b, expr.alpha, *this, T(0)};
+    }
+
+    Matrix& operator+=(const gemm::ProductExpr<Matrix>& expr) {
+        return *this = gemm::GemmExpr<Matrix>{expr.a, expr.b, expr.alpha, *this, T(1)};
+    }
+
+    bool operator==(const Matrix& other) const {
+        if (rows_ != other.rows_ || cols_ != other.cols_)
+            return false;
+        for (std::size_t i = 0; i < rows_ * cols_; ++i)
+            if (data_[i] != other.data_[i])
+                return false;
+        return true;
+    }
+};
@@ -1,91 +1,736 @@
 #include "mat.h"
+#include "batch.h"
+#include "matrix.h"
+#include "quantized.h"
+#include "sparse.h"
+
+#include "../../common/bench.h"
 
 #include <print>
 #include <chrono>
 #include <cassert>
+#include <format>
+#include <limits>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <vector>
 
 template<typename ...Args>
 inline void log_row(Args... args) {
     std::println("{:5} | {:4} | {:10} | {:10} | {:5}", args...);
 }
 
-class [[nodiscard]] ScopeTimer {
-private:
-    double* out_;
-    std::chrono::time_point<std::chrono::high_resolution_clock> start_;
+// Every measurement of the run, saved with --csv=PATH / --json=PATH.
+bench::Report report;
 
-public:
-    ScopeTimer(double* out)
-        : out_(out)
-        , start_(std::chrono::high_resolution_clock::now()) {}
+// Hardware counters for every measurement, with --counters. They count
+// the main thread only, not the pool's workers.
+std::optional<bench::PerfCounterGroup> counters;
 
-    ~ScopeTimer() {
-        auto end = std::chrono::high_resolution_clock::now();
-        *out_ = std::chrono::duration<double, std::milli>(end - start_).count();
-    }
-};
+// bench::run with the result recorded in the report.
+template<typename F>
+bench::Stats measure(std::string name, F&& fn, bench::Options options = {}) {
+    options.counters = counters ? &*counters : nullptr;
+    bench::Stats stats = bench::run(std::move(name), std::forward<F>(fn), options);
+    report.add(stats);
+    return stats;
+}
 
+// Exactly `calls` timed calls and no warmup, for runs that take seconds.
+constexpr bench::Options calls(std::size_t count) {
+    return {.warmup_ms = 0, .min_time_ms = 0, .min_samples = count, .max_samples = count, .min_sample_ns = 0};
+}
 
-constexpr double calculate_throughput_per_s(double tottime_ms, std::size_t ncalls) {
-    constexpr double ms_to_s = 1'000.0;
-    return static_cast<double>(ncalls) / tottime_ms * ms_to_s; 
+// Median calls per second, times `per_call` units of work per call.
+inline int throughput(const bench::Stats& stats, std::size_t per_call = 1) {
+    return std::round(bench::per_second(stats) * per_call);
 }
 
-constexpr double calculate_throughput_per_ms(double tottime_ms, std::size_t ncalls) {
-    return static_cast<double>(ncalls) / tottime_ms; 
+// Median milliseconds per call.
+inline double ms(const bench::Stats& stats) {
+    return std::round(stats.p50 / 1e5) / 10;
+}
 
+// How many times faster than baseline, at the median.
+inline double speedup(const bench::Stats& baseline, const bench::Stats& stats) {
+    return std::round((baseline.p50 / stats.p50) * 100) / 100;
 }
 
-template<std::size_t DIM, std::size_t ITERATIONS>
+template<std::size_t DIM>
 void test() {
-    auto a = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
-    auto b = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+    static auto a = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+    static auto b = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+
+    static SquareMatrix<std::int32_t, DIM> naive_result;
+    static SquareMatrix<std::int32_t, DIM> simd_result;
+
+    const auto naive = measure(std::format("naive/{}", DIM), [&] {
+        bench::DoNotOptimize(a);
+        naive_result = a.mul_naive(b);
+        bench::DoNotOptimize(naive_result);
+    });
+    const auto simd = measure(std::format("simd/{}", DIM), [&] {
+        bench::DoNotOptimize(a);
+        simd_result = a.mul_simd(b);
+        bench::DoNotOptimize(simd_result);
+    });
+
+    log_row(simd.iterations(), DIM, throughput(naive), throughput(simd), speedup(naive, simd));
+
+    assert(naive_result == simd_result);
+}
+
+// C = A*B + D computed two ways: mul_simd returning a fresh matrix that is
+// then added to D, and the in-place expression writing straight into C.
+template<std::size_t DIM>
+void test_in_place() {
+    static auto a = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+    static auto b = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+    static auto d = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+
+    static SquareMatrix<std::int32_t, DIM> returned_result;
+    static SquareMatrix<std::int32_t, DIM> in_place_result;
+
+    const auto returned = measure(std::format("returned/{}", DIM), [&] {
+        bench::DoNotOptimize(a);
+        returned_result = a.mul_simd(b);
+        for (std::size_t y = 0; y < DIM; ++y)
+            for (std::size_t x = 0; x < DIM; ++x)
+                returned_result(y, x) += d(y, x);
+        bench::DoNotOptimize(returned_result);
+    });
+    const auto in_place = measure(std::format("in_place/{}", DIM), [&] {
+        bench::DoNotOptimize(a);
+        in_place_result = a * b + d;
+        bench::DoNotOptimize(in_place_result);
+    });
+
+    log_row(in_place.iterations(), DIM, throughput(returned), throughput(in_place), speedup(returned, in_place));
+
+    assert(returned_result == in_place_result);
+}
+
+template<std::size_t DIM>
+void test_parallel(std::size_t thread_count) {
+    static auto a = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+    static auto b = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+    static auto naive_result = a.mul_naive(b);
+
+    static SquareMatrix<std::int32_t, DIM> simd_result;
+    static SquareMatrix<std::int32_t, DIM> parallel_result;
+
+    WorkerPool pool(thread_count);
+
+    const auto simd = measure(std::format("simd/{}", DIM), [&] {
+        simd_result = a.mul_simd(b);
+        bench::DoNotOptimize(simd_result);
+    });
+    const auto parallel = measure(std::format("parallel x{}/{}", thread_count, DIM), [&] {
+        parallel_result = a.mul_parallel(b, pool);
+        bench::DoNotOptimize(parallel_result);
+    });
+
+    log_row(thread_count, DIM, throughput(simd), throughput(parallel), speedup(simd, parallel));
+
+    assert(naive_result == parallel_result);
+}
+
+template<std::size_t ITERATIONS>
+void test_large(std::size_t dim, WorkerPool& pool) {
+    auto a = Matrix<std::int32_t>::make_random(dim, dim, 1, 10, pool);
+    auto b = Matrix<std::int32_t>::make_random(dim, dim, 1, 10, pool);
+
+    Matrix<std::int32_t> a_huge(a.rows(), a.cols(), Backing::HugePages);
+    Matrix<std::int32_t> b_huge(b.rows(), b.cols(), Backing::HugePages);
+    std::copy_n(a.data(), dim * dim, a_huge.data());
+    std::copy_n(b.data(), dim * dim, b_huge.data());
+
+    Matrix<std::int32_t> regular_result;
+    Matrix<std::int32_t> huge_result;
+
+    const auto regular = measure(std::format("regular pages/{}", dim), [&] {
+        regular_result = a.mul_parallel(b, pool);
+    }, calls(ITERATIONS));
+    const auto huge = measure(std::format("huge pages/{}", dim), [&] {
+        huge_result = a_huge.mul_parallel(b_huge, pool);
+    }, calls(ITERATIONS));
+
+    log_row(ITERATIONS, dim, ms(regular), ms(huge), speedup(regular, huge));
+
+    assert(regular_result == huge_result);
+}
+
+void test_rectangular(std::size_t M, std::size_t K, std::size_t N) {
+    auto a = Matrix<std::int32_t>::make_random(M, K, 1, 10);
+    auto b = Matrix<std::int32_t>::make_random(K, N, 1, 10);
+
+    assert(a.mul_naive(b) == a.mul_simd(b));
+}
+
+template<std::size_t DIM>
+void test_kernels() {
+    auto a = Matrix<std::int32_t>::make_random(DIM, DIM, 1, 10);
+    auto b = Matrix<std::int32_t>::make_random(DIM, DIM, 1, 10);
+    const auto expected = a.mul_naive(b);
+
+    const auto kernels = gemm::available_kernels<std::int32_t>();
+    std::optional<bench::Stats> native;
+
+    for (auto it = kernels.rbegin(); it != kernels.rend(); ++it) {
+        Matrix<std::int32_t> product(DIM, DIM);
+
+        const std::string label = std::format("{} {}x{}", it->name, it->mr, it->nr);
+        const auto stats = measure(std::format("kernel {}/{}", label, DIM), [&] {
+            std::fill_n(product.data(), DIM * DIM, 0);
+            gemm::multiply(*it, gemm::DEFAULT_BLOCKING, a.data(), DIM, b.data(), DIM, product.data(), DIM, DIM, DIM, DIM);
+            bench::ClobberMemory();
+        });
+
+        if (!native)
+            native = stats;
+
+        log_row(stats.iterations(), DIM, label, throughput(stats), speedup(*native, stats));
+
+        assert(product == expected);
+    }
+}
+
+// mul_simd against the divide and conquer variants on one dim x dim
+// product, each timed on its own and checked against mul_simd's result.
+template<std::size_t ITERATIONS>
+void test_recursive(std::size_t dim) {
+    auto a = Matrix<std::int32_t>::make_random(dim, dim, 1, 10);
+    auto b = Matrix<std::int32_t>::make_random(dim, dim, 1, 10);
+
+    Matrix<std::int32_t> expected;
+    const auto simd = measure(std::format("simd/{}", dim), [&] { expected = a.mul_simd(b); }, calls(ITERATIONS));
+
+    log_row(ITERATIONS, dim, "simd", ms(simd), 1);
+
+    const auto run = [&](const char* variant, auto&& multiply) {
+        Matrix<std::int32_t> result;
+        const auto stats = measure(std::format("{}/{}", variant, dim), [&] { result = multiply(); }, calls(ITERATIONS));
+
+        log_row(ITERATIONS, dim, variant, ms(stats), speedup(simd, stats));
+
+        assert(result == expected);
+    };
+
+    run("recursive",  [&] { return a.mul_recursive(b); });
+    run("strassen 1", [&] { return a.mul_strassen(b, gemm::DEFAULT_LEAF, 1); });
+    run("strassen 2", [&] { return a.mul_strassen(b, gemm::DEFAULT_LEAF, 2); });
+}
+
+// Every quantized kernel for one operand type against int32 mul_simd on the
+// same values, each checked against the scalar reference.
+template<typename Q, std::size_t DIM>
+void test_quantized(const bench::Stats& simd) {
+    const auto a = Matrix<Q>::make_random(DIM, DIM, std::numeric_limits<Q>::min(), std::numeric_limits<Q>::max());
+    const auto b = Matrix<Q>::make_random(DIM, DIM, std::numeric_limits<Q>::min(), std::numeric_limits<Q>::max());
 
-    SquareMatrix<std::int32_t, DIM> naive_result;
-    SquareMatrix<std::int32_t, DIM> simd_result;
+    Matrix<std::int32_t> expected(DIM, DIM);
+    gemm::multiply_quantized_reference(a.data(), DIM, b.data(), DIM, expected.data(), DIM, DIM, DIM, DIM);
 
-    double naive_tottime;
-    double simd_tottime;
-    
-    {
-        auto _ = ScopeTimer(&naive_tottime);
-        for (std::size_t i = 0; i < ITERATIONS; ++i) 
-            naive_result = a.mul_naive(b);
+    for (const auto& kernel : gemm::available_quant_kernels<Q>()) {
+        Matrix<std::int32_t> product(DIM, DIM);
 
+        const std::string label = std::format("{} {}", gemm::type_key<Q>(), kernel.name);
+        const auto stats = measure(std::format("quantized {}/{}", label, DIM), [&] {
+            std::fill_n(product.data(), DIM * DIM, 0);
+            gemm::multiply_quantized(kernel, gemm::QUANT_BLOCKING, a.data(), DIM, b.data(), DIM, product.data(), DIM, DIM, DIM, DIM);
+            bench::ClobberMemory();
+        });
+
+        log_row(stats.iterations(), DIM, label, throughput(stats), speedup(simd, stats));
+
+        assert(product == expected);
     }
 
-    {
-        auto _ = ScopeTimer(&simd_tottime);
-        for (std::size_t i = 0; i < ITERATIONS; ++i) 
-            simd_result = a.mul_simd(b);
+    // The scale-factor API on real values in [-1, 1]: the kernels must
+    // match the reference exactly, and the rescaled product must be
+    // within the rounding error of the quantized inputs. Each element of
+    // either input is off by at most half its scale, so an output element
+    // is off by at most DIM * (|A| sB / 2 + |B| sA / 2 + sA sB / 4).
+    // Full-scale int16 would overflow the int32 sums and is refused.
+    const auto real = [] {
+        auto m = Matrix<float>::make_random(DIM, DIM, -1000, 1000);
+        for (std::size_t i = 0; i < DIM * DIM; ++i)
+            m.data()[i] /= 1000;
+        return m;
+    };
+    const auto real_a = real();
+    const auto real_b = real();
+
+    const auto qa = QuantizedMatrix<Q>::quantize(real_a);
+    const auto qb = QuantizedMatrix<Q>::quantize(real_b);
+
+    bool rejected = false;
+    auto not_finite = real_a;
+    not_finite.data()[0] = std::numeric_limits<float>::quiet_NaN();
+    try {
+        QuantizedMatrix<Q>::quantize(not_finite);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
     }
+    assert(rejected);
 
-    const int naive_throughput = std::round(calculate_throughput_per_s(naive_tottime, ITERATIONS));
-    const int simd_throughput  = std::round(calculate_throughput_per_s(simd_tottime,  ITERATIONS));
-    const double scale = std::round((naive_tottime / simd_tottime) * 100) / 100;
+    if constexpr (std::is_same_v<Q, std::int16_t>) {
+        bool refused = false;
+        try {
+            qa.mul(qb);
+        } catch (const std::overflow_error&) {
+            refused = true;
+        }
+        assert(refused);
+        return;
+    }
 
-    log_row(ITERATIONS, DIM, naive_throughput, simd_throughput, scale);
+    assert(qa.mul_int32(qb) == qa.mul_reference(qb));
 
-    assert(naive_result == simd_result);
+    const Matrix<float> approximate = qa.mul(qb);
+    const double bound = DIM * (qb.scale() / 2.0 + qa.scale() / 2.0 + qa.scale() * qb.scale() / 4.0) * 1.01 + 1e-5;
+    for (std::size_t i = 0; i < DIM; ++i) {
+        for (std::size_t j = 0; j < DIM; ++j) {
+            double exact = 0;
+            for (std::size_t k = 0; k < DIM; ++k)
+                exact += double(real_a.data()[i*DIM + k]) * real_b.data()[k*DIM + j];
+            assert(std::abs(approximate.data()[i*DIM + j] - exact) <= bound);
+        }
+    }
+}
+
+template<std::size_t DIM>
+void test_quantized() {
+    auto a = Matrix<std::int32_t>::make_random(DIM, DIM, -128, 127);
+    auto b = Matrix<std::int32_t>::make_random(DIM, DIM, -128, 127);
+
+    const auto simd = measure(std::format("quantized i32 mul_simd/{}", DIM), [&] { return a.mul_simd(b); });
+    log_row(simd.iterations(), DIM, "i32 mul_simd", throughput(simd), 1);
+
+    test_quantized<std::int16_t, DIM>(simd);
+    test_quantized<std::int8_t,  DIM>(simd);
+}
+
+// COUNT independent N x N products per iteration: mul_simd called once per
+// pair against one mul_batch over the whole batch, for every batch kernel.
+// Throughput is matrix products per second.
+template<std::size_t N, std::size_t COUNT>
+void test_batch() {
+    const auto a_batch = MatrixBatch<std::int32_t, N>::make_random(COUNT, 1, 10);
+    const auto b_batch = MatrixBatch<std::int32_t, N>::make_random(COUNT, 1, 10);
+
+    std::vector<SquareMatrix<std::int32_t, N>> as(COUNT), bs(COUNT), products(COUNT);
+    for (std::size_t m = 0; m < COUNT; ++m) {
+        as[m] = a_batch.get(m);
+        bs[m] = b_batch.get(m);
+    }
+
+    const auto simd = measure(std::format("batch mul_simd/{}", N), [&] {
+        for (std::size_t m = 0; m < COUNT; ++m)
+            products[m] = as[m].mul_simd(bs[m]);
+        bench::ClobberMemory();
+    });
+    log_row(COUNT, N, "mul_simd", throughput(simd, COUNT), 1);
+
+    for (const auto& kernel : gemm::available_batch_kernels<std::int32_t, N>()) {
+        MatrixBatch<std::int32_t, N> product;
+
+        const auto stats = measure(std::format("batch {}/{}", kernel.name, N), [&] {
+            product = a_batch.mul_batch(b_batch, kernel);
+        });
+
+        log_row(COUNT, N, std::format("batch {}", kernel.name), throughput(stats, COUNT), speedup(simd, stats));
+
+        for (std::size_t m = 0; m < COUNT; ++m)
+            assert(product.get(m) == products[m]);
+    }
+}
+
+// A DIM x DIM operand with `zeros` per mille of its elements zeroed, times
+// a dense matrix and a dense vector: dense mul_simd against the CSR
+// kernels, serial and across the pool. Throughput is products per second.
+template<std::size_t DIM>
+void test_sparse(int zeros, WorkerPool& pool) {
+    static const auto values = SquareMatrix<std::int32_t, DIM>::make_random(1, 10, 1);
+    static const auto mask = SquareMatrix<std::int32_t, DIM>::make_random(0, 999, 2);
+    static const auto b = SquareMatrix<std::int32_t, DIM>::make_random(1, 10, 3);
+
+    static SquareMatrix<std::int32_t, DIM> a;
+    for (std::size_t i = 0; i < DIM*DIM; ++i)
+        a.data()[i] = mask.data()[i] < zeros ? 0 : values.data()[i];
+
+    const auto sparse = SparseMatrix<std::int32_t>::from_dense(a);
+
+    const auto x = Matrix<std::int32_t>::make_random(DIM, 1, 1, 10, Backing::Regular, 4);
+    const std::vector<std::int32_t> x_vector(x.data(), x.data() + DIM);
+
+    const std::string level = std::format("{}.{}%", zeros / 10, zeros % 10);
+
+    const auto run = [&](std::string variant, const bench::Stats* baseline, auto&& multiply) {
+        const auto stats = measure(std::format("sparse {} {}/{}", level, variant, DIM), [&] {
+            multiply();
+            bench::ClobberMemory();
+        });
+
+        log_row(stats.iterations(), DIM, variant, throughput(stats), baseline ? speedup(*baseline, stats) : 1);
+        return stats;
+    };
+
+    static SquareMatrix<std::int32_t, DIM> dense_product, serial_product, parallel_product;
+    const auto dense = run("dense " + level, nullptr, [&] { dense_product = a.mul_simd(b); });
+    run("spmm", &dense, [&] { serial_product = sparse.mul_dense(b); });
+    run(std::format("spmm x{}", pool.size()), &dense, [&] { parallel_product = sparse.mul_dense(b, pool); });
+
+    assert(serial_product == dense_product);
+    assert(parallel_product == dense_product);
+
+    Matrix<std::int32_t> a_matrix(DIM, DIM);
+    std::copy_n(a.data(), DIM*DIM, a_matrix.data());
+
+    Matrix<std::int32_t> dense_y;
+    std::vector<std::int32_t> serial_y, parallel_y;
+    const auto dense_mv = run("dense mv", nullptr, [&] { dense_y = a_matrix.mul_simd(x); });
+    run("spmv", &dense_mv, [&] { serial_y = sparse.mul_vector(x_vector); });
+    run(std::format("spmv x{}", pool.size()), &dense_mv, [&] { parallel_y = sparse.mul_vector(x_vector, pool); });
+
+    assert(std::equal(serial_y.begin(), serial_y.end(), dense_y.data()));
+    assert(parallel_y == serial_y);
+}
+
+// Cholesky and LU of a dim x dim symmetric positive definite double
+// matrix: the unblocked references against the blocked routines, whose
+// factors must reproduce the input to a small residual.
+template<std::size_t ITERATIONS>
+void test_factor(std::size_t dim, WorkerPool& pool) {
+    const auto b = Matrix<double>::make_random(dim, dim, -10, 10, Backing::Regular, 5);
+    Matrix<double> b_transposed(dim, dim);
+    for (std::size_t y = 0; y < dim; ++y)
+        for (std::size_t x = 0; x < dim; ++x)
+            b_transposed(x, y) = b(y, x);
+
+    Matrix<double> a = b.mul_simd(b_transposed);
+    for (std::size_t i = 0; i < dim; ++i)
+        a(i, i) += dim;
+
+    const auto run = [&](const char* variant, const bench::Stats* baseline, auto&& factor) {
+        const auto stats = measure(std::format("{}/{}", variant, dim), factor, calls(ITERATIONS));
+
+        log_row(ITERATIONS, dim, variant, ms(stats), baseline ? speedup(*baseline, stats) : 1);
+        return stats;
+    };
+
+    constexpr double TOLERANCE = 1e-12;
+
+    Matrix<double> l;
+    const auto cholesky = run("chol naive", nullptr, [&] {
+        l = a;
+        gemm::cholesky_unblocked(l.data(), dim, dim);
+    });
+    assert(gemm::cholesky_residual(a.data(), dim, l.data(), dim, dim) < TOLERANCE);
+
+    run("cholesky", &cholesky, [&] { l = a.cholesky(pool); });
+    assert(gemm::cholesky_residual(a.data(), dim, l.data(), dim, dim) < TOLERANCE);
+
+    Matrix<double> lu;
+    std::vector<std::size_t> pivots(dim);
+    const auto lu_naive = run("lu naive", nullptr, [&] {
+        lu = a;
+        gemm::lu_unblocked(lu.data(), dim, dim, pivots.data());
+    });
+    assert(gemm::lu_residual(a.data(), dim, lu.data(), dim, pivots.data(), dim) < TOLERANCE);
+
+    run("lu", &lu_naive, [&] { lu = a.lu(pivots, pool); });
+    assert(gemm::lu_residual(a.data(), dim, lu.data(), dim, pivots.data(), dim) < TOLERANCE);
+}
+
+// philox4x32 against the Random123 known-answer vectors for
+// Philox4x32-10, and generate() against philox4x32 block by block, for
+// counters that cross 32-bit boundaries and keys with both halves set.
+void test_philox() {
+    struct Known {
+        std::uint32_t counter[4];
+        std::uint32_t key[2];
+        std::uint32_t expected[4];
+    };
+    constexpr Known KNOWN[] = {
+        {{0, 0, 0, 0}, {0, 0}, {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+        {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff},
+         {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+        {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0},
+         {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}},
+    };
+    for (const Known& known : KNOWN) {
+        std::uint32_t out[4];
+        rng::philox4x32(known.counter, known.key, out);
+        assert(std::equal(out, out + 4, known.expected));
+    }
+
+    alignas(64) std::uint32_t chunk[rng::PHILOX_CHUNK];
+    for (const std::uint64_t key : {0ull, 42ull, 0x243f6a8885a308d3ull, ~0ull}) {
+        for (const std::uint64_t counter : {0ull, 16ull, 0xfffffff8ull, 0x123456789abcdef0ull, ~0ull - 7}) {
+            rng::generate(counter, key, chunk);
+            for (std::size_t block = 0; block < rng::PHILOX_LANES; ++block) {
+                std::uint32_t out[4];
+                rng::philox4x32(counter + block, key, out);
+                assert(std::equal(out, out + 4, chunk + block * 4));
+            }
+        }
+    }
 }
 
-template<
-    std::size_t SCALE, 
-    std::size_t... ITERATIONS
->
-constexpr void test_iterations() {
-    (test<SCALE, ITERATIONS>(), ...);
+// Generating a dim x dim input: the old one-at-a-time mt19937 fill against
+// the Philox fill, serial and across the pool, in ms per matrix. The
+// parallel fill must reproduce the serial one exactly.
+template<std::size_t ITERATIONS>
+void test_random(std::size_t dim, WorkerPool& pool) {
+    constexpr std::uint64_t SEED = 42;
+
+    const auto mt = measure(std::format("mt19937/{}", dim), [&] {
+        std::mt19937 gen(SEED);
+        std::uniform_int_distribution<> distrib(1, 10);
+
+        Matrix<std::int32_t> m(dim, dim);
+        for (std::size_t e = 0; e < dim * dim; ++e)
+            m.data()[e] = distrib(gen);
+        return m;
+    }, calls(ITERATIONS));
+
+    log_row(ITERATIONS, dim, "mt19937", ms(mt), 1);
+
+    Matrix<std::int32_t> serial;
+    Matrix<std::int32_t> parallel;
+
+    const auto run = [&](std::string variant, Matrix<std::int32_t>& result, auto&& make) {
+        const auto stats = measure(std::format("{}/{}", variant, dim), [&] { result = make(); }, calls(ITERATIONS));
+
+        log_row(ITERATIONS, dim, variant, ms(stats), speedup(mt, stats));
+    };
+
+    run("philox", serial, [&] {
+        return Matrix<std::int32_t>::make_random(dim, dim, 1, 10, Backing::Regular, SEED);
+    });
+    run(std::format("philox x{}", pool.size()), parallel, [&] {
+        return Matrix<std::int32_t>::make_random(dim, dim, 1, 10, pool, Backing::Regular, SEED);
+    });
+
+    assert(serial == parallel);
+}
+
+// Small DIM x DIM products: the tiled gemm path against the straight-line
+// mul_unrolled that mul_simd now picks for DIM <= 8.
+template<std::size_t DIM>
+void test_unrolled() {
+    auto a = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+    auto b = SquareMatrix<std::int32_t, DIM>::make_random(1, 10);
+
+    SquareMatrix<std::int32_t, DIM> tiled_result;
+    SquareMatrix<std::int32_t, DIM> unrolled_result;
+
+    const auto tiled = measure(std::format("tiled/{}", DIM), [&] {
+        bench::DoNotOptimize(a);
+        tiled_result = a.mul_tiled(b);
+        bench::DoNotOptimize(tiled_result);
+    });
+    const auto unrolled = measure(std::format("unrolled/{}", DIM), [&] {
+        bench::DoNotOptimize(a);
+        unrolled_result = a.mul_unrolled(b);
+        bench::DoNotOptimize(unrolled_result);
+    });
+
+    log_row(unrolled.iterations(), DIM, throughput(tiled), throughput(unrolled), speedup(tiled, unrolled));
+
+    assert(tiled_result == unrolled_result);
+}
+
+// mul_unrolled in a constant expression: four quarter turns are the identity.
+constexpr SquareMatrix<std::int32_t, 2> QUARTER_TURN({0, -1, 1, 0});
+static_assert(QUARTER_TURN.mul_unrolled(QUARTER_TURN).mul_unrolled(QUARTER_TURN).mul_unrolled(QUARTER_TURN)
+              == SquareMatrix<std::int32_t, 2>::identity());
+
+template<std::size_t... DIMS>
+constexpr void test_sizes() {
+    (test<DIMS>(), ...);
+}
+
+// Multiplies of the DIM x DIM operands with one kernel and blocking.
+template<std::size_t DIM>
+bench::Stats time_config(
+    const Matrix<std::int32_t>& a, const Matrix<std::int32_t>& b,
+    const Matrix<std::int32_t>& expected,
+    const gemm::Kernel<std::int32_t>& kernel, const gemm::Blocking& blocking
+) {
+    Matrix<std::int32_t> product(DIM, DIM);
+
+    const auto stats = bench::run(
+        std::format("{} {}x{} {}/{}/{}", kernel.name, kernel.mr, kernel.nr, blocking.mc, blocking.kc, blocking.nc),
+        [&] {
+            std::fill_n(product.data(), DIM * DIM, 0);
+            gemm::multiply(kernel, blocking, a.data(), DIM, b.data(), DIM, product.data(), DIM, DIM, DIM, DIM);
+            bench::ClobberMemory();
+        }
+    );
+
+    assert(product == expected);
+    return stats;
+}
+
+// --tune: time every kernel shape at the blocking suggested by the cache
+// sizes, then sweep MC/KC/NC for the fastest one, and store the winner in
+// the tune file the matrix types load.
+template<std::size_t DIM>
+void tune() {
+    const gemm::CacheSizes caches = gemm::detect_cache_sizes();
+    std::println("L1d {} KiB, L2 {} KiB, L3 {} KiB", caches.l1d / 1024, caches.l2 / 1024, caches.l3 / 1024);
+
+    auto a = Matrix<std::int32_t>::make_random(DIM, DIM, 1, 10);
+    auto b = Matrix<std::int32_t>::make_random(DIM, DIM, 1, 10);
+    const auto expected = a.mul_naive(b);
+
+    log_row("COUNT", "SIZE", "KERNEL", "THROUGHPUT", "BLOCKING");
+    std::println("----------------------------------------");
+
+    gemm::Config<std::int32_t> best{gemm::default_kernel<std::int32_t>(), gemm::DEFAULT_BLOCKING};
+    double best_time = 0;
+
+    for (const auto& kernel : gemm::available_kernels<std::int32_t>()) {
+        const gemm::Blocking blocking = gemm::suggest_blocking(kernel, caches);
+        const auto stats = time_config<DIM>(a, b, expected, kernel, blocking);
+
+        log_row(stats.iterations(), DIM, std::format("{} {}x{}", kernel.name, kernel.mr, kernel.nr), throughput(stats),
+                std::format("{}/{}/{}", blocking.mc, blocking.kc, blocking.nc));
+
+        if (best_time == 0 || stats.p50 < best_time) {
+            best = {kernel, blocking};
+            best_time = stats.p50;
+        }
+    }
+
+    std::println();
+    log_row("COUNT", "SIZE", "KERNEL", "THROUGHPUT", "BLOCKING");
+    std::println("----------------------------------------");
+
+    for (const auto& blocking : gemm::blocking_candidates(best.kernel, caches)) {
+        const auto stats = time_config<DIM>(a, b, expected, best.kernel, blocking);
+
+        log_row(stats.iterations(), DIM, std::format("{} {}x{}", best.kernel.name, best.kernel.mr, best.kernel.nr),
+                throughput(stats), std::format("{}/{}/{}", blocking.mc, blocking.kc, blocking.nc));
+
+        if (stats.p50 < best_time) {
+            best.blocking = blocking;
+            best_time = stats.p50;
+        }
+    }
+
+    const std::string path = gemm::tune_file_path();
+    gemm::save_config(path, best);
+
+    std::println();
+    std::println("wrote {} {}x{} {}/{}/{} to {}",
+                 best.kernel.name, best.kernel.mr, best.kernel.nr,
+                 best.blocking.mc, best.blocking.kc, best.blocking.nc, path);
 }
 
-int main() {
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string_view(argv[1]) == "--tune") {
+        tune<512>();
+        return 0;
+    }
+
+    for (int i = 1; i < argc; ++i)
+        if (std::string_view(argv[i]) == "--counters")
+            counters = bench::PerfCounterGroup::make();
+
     log_row("COUNT", "SIZE", "NAIVE", "SIMD", "SCALE");
     std::println("----------------------------------------");
-    test_iterations<4,   10'000>();
-    test_iterations<8,   10'000>();
-    test_iterations<16,  10'000>();
-    test_iterations<32,  10'000>();
-    test_iterations<64,  10'000>();
-    test_iterations<128, 10'000>();
-    test_iterations<256, 10'000>();
+    test_sizes<4, 8, 16, 32, 64, 128, 256, 100, 130>();
+
+    std::println();
+    log_row("COUNT", "SIZE", "TILED", "UNROLLED", "SCALE");
+    std::println("----------------------------------------");
+    test_unrolled<2>();
+    test_unrolled<4>();
+    test_unrolled<8>();
+
+    std::println();
+    log_row("COUNT", "SIZE", "RETURNED", "IN PLACE", "SCALE");
+    std::println("----------------------------------------");
+    test_in_place<4>();
+    test_in_place<8>();
+    test_in_place<16>();
+    test_in_place<32>();
+    test_in_place<64>();
+    test_in_place<128>();
+    test_in_place<256>();
+
+    std::println();
+    log_row("THRDS", "SIZE", "SIMD", "PARALLEL", "SCALE");
+    std::println("----------------------------------------");
+    for (std::size_t threads: {1, 2, 4, 8, 16})
+        test_parallel<256>(threads);
+
+    std::println();
+    const auto& config = gemm::active_config<std::int32_t>();
+    std::println("mul_simd dispatches to: {} {}x{}, blocking {}/{}/{}",
+                 config.kernel.name, config.kernel.mr, config.kernel.nr,
+                 config.blocking.mc, config.blocking.kc, config.blocking.nc);
+    log_row("COUNT", "SIZE", "KERNEL", "THROUGHPUT", "SCALE");
+    std::println("----------------------------------------");
+    test_kernels<256>();
+
+    test_rectangular(96, 64, 160);
+    test_rectangular(256, 512, 128);
+    test_rectangular(100, 37, 130);
+    test_rectangular(1, 7, 3);
+
+    WorkerPool pool(std::max<std::size_t>(1, std::thread::hardware_concurrency()));
+
+    std::println();
+    log_row("COUNT", "SIZE", "REGULAR MS", "HUGEPAGE MS", "SCALE");
+    std::println("----------------------------------------");
+    test_large<10>(1024, pool);
+    test_large<3>(2048, pool);
+    test_large<1>(4096, pool);
+
+    std::println();
+    log_row("COUNT", "SIZE", "VARIANT", "MS", "SCALE");
+    std::println("----------------------------------------");
+    test_recursive<3>(512);
+    test_recursive<3>(1024);
+    test_recursive<1>(2048);
+    test_recursive<1>(4096);
+
+    std::println();
+    log_row("COUNT", "SIZE", "KERNEL", "THROUGHPUT", "SCALE");
+    std::println("----------------------------------------");
+    test_quantized<256>();
+
+    std::println();
+    log_row("COUNT", "SIZE", "KERNEL", "THROUGHPUT", "SCALE");
+    std::println("----------------------------------------");
+    test_batch<4, 10'000>();
+    test_batch<8, 10'000>();
+
+    std::println();
+    log_row("COUNT", "SIZE", "VARIANT", "THROUGHPUT", "SCALE");
+    std::println("----------------------------------------");
+    for (int zeros: {500, 900, 990, 999})
+        test_sparse<256>(zeros, pool);
+
+    std::println();
+    log_row("COUNT", "SIZE", "VARIANT", "MS", "SCALE");
+    std::println("----------------------------------------");
+    test_factor<3>(512, pool);
+    test_factor<1>(1024, pool);
+    test_factor<1>(2048, pool);
+
+    std::println();
+    log_row("COUNT", "SIZE", "VARIANT", "MS", "SCALE");
+    std::println("----------------------------------------");
+    test_philox();
+    test_random<10>(1024, pool);
+    test_random<3>(4096, pool);
+
+    report.save(argc, argv);
     return 0;
 }
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <print>
+#include <thread>
+#include <vector>
+
+#include "../../common/affinity.h"
+
+// Fixed set of worker threads, each pinned to its own core out of the ones
+// the process may run on (wrapping around when there are more workers than
+// cores, and left unpinned if the kernel refuses). run() hands every worker
+// the same job along with its id and blocks until all of them have
+// finished, so the threads are created once and reused across multiplies.
+class WorkerPool {
+private:
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable job_ready_;
+    std::condition_variable job_done_;
+
+    std::function<void(std::size_t, std::size_t)> job_;
+    std::size_t generation_ = 0;
+    std::size_t pending_ = 0;
+    bool stopping_ = false;
+
+    void worker_main(std::size_t id) {
+        std::size_t seen_generation = 0;
+
+        while (true) {
+            std::unique_lock lock(mutex_);
+            job_ready_.wait(lock, [&] { return stopping_ || generation_ != seen_generation; });
+            if (stopping_)
+                return;
+
+            seen_generation = generation_;
+            lock.unlock();
+
+            job_(id, workers_.size());
+
+            lock.lock();
+            if (--pending_ == 0)
+                job_done_.notify_one();
+        }
+    }
+
+public:
+
+    // At least one worker, so a thread count from hardware_concurrency(),
+    // which may be 0, still runs every job.
+    explicit WorkerPool(std::size_t thread_count) {
+        thread_count = std::max<std::size_t>(1, thread_count);
+        const std::vector<int> cpus = bench::allowed_cpus();
+
+        workers_.reserve(thread_count);
+        for (std::size_t i = 0; i < thread_count; ++i) {
+            workers_.emplace_back(&WorkerPool::worker_main, this, i);
+            if (cpus.empty())
+                continue;
+
+            const int cpu = cpus[i % cpus.size()];
+            if (!bench::pin_thread(workers_.back().native_handle(), cpu))
+                std::println("Could not pin worker {} to CPU {}", i, cpu);
+        }
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        job_ready_.notify_all();
+
+        for (auto& worker: workers_)
+            worker.join();
+    }
+
+    std::size_t size() const {
+        return workers_.size();
+    }
+
+    // fn(worker_id, worker_count) runs once on every worker; on the calling
+    // thread as the only worker if there are none.
+    void run(std::function<void(std::size_t, std::size_t)> fn) {
+        if (workers_.empty()) {
+            fn(0, 1);
+            return;
+        }
+
+        std::unique_lock lock(mutex_);
+        job_ = std::move(fn);
+        pending_ = workers_.size();
+        ++generation_;
+        job_ready_.notify_all();
+
+        job_done_.wait(lock, [&] { return pending_ == 0; });
+    }
+};
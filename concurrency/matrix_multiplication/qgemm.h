@@ -0,0 +1,335 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "cpu_features.h"
+#include "gemm.h"
+
+// Quantized multiply: int8 or int16 operands, int32 accumulation.
+//
+//     C[M x N] += A[M x K] * B[K x N]     (A, B int8 or int16, C int32)
+//
+// The kernels use widening multiply-adds, which pack two (pmaddwd) or four
+// (vpdpbusd) K values into every 32-bit lane, so each vector instruction
+// does 2-4x the multiplies of the int32 kernel. pmaddubsw is not used: its
+// int16 pair sums saturate, so the result would not match a plain int32
+// sum. int8 is instead widened to int16 for pmaddwd, or offset to unsigned
+// for vpdpbusd, which accumulates without saturating. Either way the output
+// is bit-identical to multiply_quantized_reference.
+namespace gemm {
+
+template<typename T>
+using qtile_fn = void (*)(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    std::int32_t* C, std::size_t ldc,
+    std::size_t ii, std::size_t i_end,
+    std::size_t jj, std::size_t j_end,
+    std::size_t K, std::size_t kc,
+    void* A_pack, void* B_pack
+);
+
+// One compiled qmul_tile instantiation. a_offset is what the kernel adds to
+// every A element, to be taken back out of C once the product is done.
+template<typename T>
+struct QuantKernel {
+    const char* name;
+    std::size_t mr;
+    std::size_t nr;
+    std::int32_t a_offset;
+    qtile_fn<T> tile;
+};
+
+// A pack groups hold at most four K values, so kc is rounded up to that.
+constexpr std::size_t QUANT_GROUP = 4;
+
+constexpr Blocking QUANT_BLOCKING{96, 512, 256};
+
+} // namespace gemm
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vnni")
+namespace gemm::avx512vnni {
+
+// int8 through vpdpbusd: unsigned A bytes times signed B bytes, four per
+// int32 lane.
+struct Dpbusd512 {
+    using type = __m512i;
+    using a_type = std::uint8_t;
+    using b_type = std::int8_t;
+    constexpr static std::size_t width = 16;
+    constexpr static std::size_t group = 4;
+    constexpr static std::int32_t a_offset = 128;
+
+    static void zero(type& v) { v = _mm512_setzero_si512(); }
+    static void load(type& v, const void* p) { v = _mm512_load_si512(p); }
+    static void broadcast(type& v, const void* p) {
+        std::int32_t x;
+        std::memcpy(&x, p, sizeof(x));
+        v = _mm512_set1_epi32(x);
+    }
+    static void dot(type& c, const type& a, const type& b) { c = _mm512_dpbusd_epi32(c, a, b); }
+    static void add_to(std::int32_t* p, const type& c) {
+        _mm512_storeu_si512(p, _mm512_add_epi32(_mm512_loadu_si512(p), c));
+    }
+};
+
+#include "qtile.inl"
+
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+namespace gemm::avx512bw {
+
+// int16 pairs through vpmaddwd; int8 is widened to int16 while packing.
+struct Madd512 {
+    using type = __m512i;
+    using a_type = std::int16_t;
+    using b_type = std::int16_t;
+    constexpr static std::size_t width = 16;
+    constexpr static std::size_t group = 2;
+    constexpr static std::int32_t a_offset = 0;
+
+    static void zero(type& v) { v = _mm512_setzero_si512(); }
+    static void load(type& v, const void* p) { v = _mm512_load_si512(p); }
+    static void broadcast(type& v, const void* p) {
+        std::int32_t x;
+        std::memcpy(&x, p, sizeof(x));
+        v = _mm512_set1_epi32(x);
+    }
+    static void dot(type& c, const type& a, const type& b) {
+        c = _mm512_add_epi32(c, _mm512_madd_epi16(a, b));
+    }
+    static void add_to(std::int32_t* p, const type& c) {
+        _mm512_storeu_si512(p, _mm512_add_epi32(_mm512_loadu_si512(p), c));
+    }
+};
+
+#include "qtile.inl"
+
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,avxvnni")
+namespace gemm::avxvnni {
+
+// The VEX encoded vpdpbusd of AVX-VNNI, on 256-bit vectors.
+struct Dpbusd256 {
+    using type = __m256i;
+    using a_type = std::uint8_t;
+    using b_type = std::int8_t;
+    constexpr static std::size_t width = 8;
+    constexpr static std::size_t group = 4;
+    constexpr static std::int32_t a_offset = 128;
+
+    static void zero(type& v) { v = _mm256_setzero_si256(); }
+    static void load(type& v, const void* p) { v = _mm256_load_si256(static_cast<const __m256i*>(p)); }
+    static void broadcast(type& v, const void* p) {
+        std::int32_t x;
+        std::memcpy(&x, p, sizeof(x));
+        v = _mm256_set1_epi32(x);
+    }
+    static void dot(type& c, const type& a, const type& b) { c = _mm256_dpbusd_avx_epi32(c, a, b); }
+    static void add_to(std::int32_t* p, const type& c) {
+        __m256i* q = reinterpret_cast<__m256i*>(p);
+        _mm256_storeu_si256(q, _mm256_add_epi32(_mm256_loadu_si256(q), c));
+    }
+};
+
+#include "qtile.inl"
+
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace gemm::avx2 {
+
+struct Madd256 {
+    using type = __m256i;
+    using a_type = std::int16_t;
+    using b_type = std::int16_t;
+    constexpr static std::size_t width = 8;
+    constexpr static std::size_t group = 2;
+    constexpr static std::int32_t a_offset = 0;
+
+    static void zero(type& v) { v = _mm256_setzero_si256(); }
+    static void load(type& v, const void* p) { v = _mm256_load_si256(static_cast<const __m256i*>(p)); }
+    static void broadcast(type& v, const void* p) {
+        std::int32_t x;
+        std::memcpy(&x, p, sizeof(x));
+        v = _mm256_set1_epi32(x);
+    }
+    static void dot(type& c, const type& a, const type& b) {
+        c = _mm256_add_epi32(c, _mm256_madd_epi16(a, b));
+    }
+    static void add_to(std::int32_t* p, const type& c) {
+        __m256i* q = reinterpret_cast<__m256i*>(p);
+        _mm256_storeu_si256(q, _mm256_add_epi32(_mm256_loadu_si256(q), c));
+    }
+};
+
+#include "qtile.inl"
+
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+namespace gemm::sse2 {
+
+// pmaddwd on 128-bit vectors; SSE2 is part of x86-64 itself, so this tier
+// needs no cpuid check.
+struct Madd128 {
+    using type = __m128i;
+    using a_type = std::int16_t;
+    using b_type = std::int16_t;
+    constexpr static std::size_t width = 4;
+    constexpr static std::size_t group = 2;
+    constexpr static std::int32_t a_offset = 0;
+
+    static void zero(type& v) { v = _mm_setzero_si128(); }
+    static void load(type& v, const void* p) { v = _mm_load_si128(static_cast<const __m128i*>(p)); }
+    static void broadcast(type& v, const void* p) {
+        std::int32_t x;
+        std::memcpy(&x, p, sizeof(x));
+        v = _mm_set1_epi32(x);
+    }
+    static void dot(type& c, const type& a, const type& b) {
+        c = _mm_add_epi32(c, _mm_madd_epi16(a, b));
+    }
+    static void add_to(std::int32_t* p, const type& c) {
+        __m128i* q = reinterpret_cast<__m128i*>(p);
+        _mm_storeu_si128(q, _mm_add_epi32(_mm_loadu_si128(q), c));
+    }
+};
+
+#include "qtile.inl"
+
+}
+#pragma GCC pop_options
+
+#endif
+
+namespace gemm {
+
+// Every quantized kernel the running CPU can execute for T, best first.
+// Empty off x86, where multiply_quantized falls back to the reference.
+template<typename T>
+std::vector<QuantKernel<T>> available_quant_kernels() {
+    static_assert(std::is_same_v<T, std::int8_t> || std::is_same_v<T, std::int16_t>,
+                  "quantized kernels take int8 or int16 operands");
+
+    std::vector<QuantKernel<T>> kernels;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const CpuFeatures& cpu = cpu_features();
+    constexpr bool is_int8 = std::is_same_v<T, std::int8_t>;
+
+    if constexpr (is_int8)
+        if (cpu.avx512vnni)
+            avx512vnni::append_quant_kernel<T, avx512vnni::Dpbusd512>(kernels, "avx512-vnni");
+    if (cpu.avx512bw)
+        avx512bw::append_quant_kernel<T, avx512bw::Madd512>(kernels, "avx512bw");
+    if constexpr (is_int8)
+        if (cpu.avxvnni)
+            avxvnni::append_quant_kernel<T, avxvnni::Dpbusd256>(kernels, "avx-vnni");
+    if (cpu.avx2)
+        avx2::append_quant_kernel<T, avx2::Madd256>(kernels, "avx2");
+    sse2::append_quant_kernel<T, sse2::Madd128>(kernels, "sse2");
+#endif
+
+    return kernels;
+}
+
+// Plain int32 triple loop the kernels must match exactly. Sums wrap
+// around like the kernels' 32-bit lanes do; it is done in uint32_t, since
+// overflowing a signed sum at large K would be undefined.
+template<typename T>
+void multiply_quantized_reference(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    std::int32_t* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K
+) {
+    for (std::size_t i = 0; i < M; ++i)
+        for (std::size_t j = 0; j < N; ++j) {
+            std::uint32_t sum = std::uint32_t(C[i*ldc + j]);
+            for (std::size_t k = 0; k < K; ++k)
+                sum += std::uint32_t(std::int32_t(A[i*lda + k]) * std::int32_t(B[k*ldb + j]));
+            C[i*ldc + j] = std::int32_t(sum);
+        }
+}
+
+template<typename T>
+void multiply_quantized(
+    const QuantKernel<T>& kernel, const Blocking& blocking,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    std::int32_t* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K
+) {
+    // Packs are at most int16 wide whatever T is.
+    const std::size_t kc = round_up(blocking.kc, QUANT_GROUP);
+    const std::size_t a_bytes = round_up(MAX_MR * kc * sizeof(std::int16_t), 64);
+    const std::size_t b_bytes = round_up(kc * round_up(blocking.nc, kernel.nr) * sizeof(std::int16_t), 64);
+
+    char* packs = static_cast<char*>(thread_buffer(a_bytes + b_bytes));
+
+    for (std::size_t ii = 0; ii < M; ii += blocking.mc)
+        for (std::size_t jj = 0; jj < N; jj += blocking.nc)
+            kernel.tile(
+                A, lda, B, ldb, C, ldc,
+                ii, std::min(ii + blocking.mc, M),
+                jj, std::min(jj + blocking.nc, N),
+                K, kc, packs, packs + a_bytes
+            );
+
+    if (kernel.a_offset == 0)
+        return;
+
+    // The kernel computed sum((a + offset) * b), so every C[i][j] is
+    // offset * colsum(B)[j] too high. Unsigned arithmetic, since the
+    // intermediate may wrap even when the final value fits in int32.
+    std::vector<std::uint32_t> correction(N, 0);
+    for (std::size_t k = 0; k < K; ++k)
+        for (std::size_t j = 0; j < N; ++j)
+            correction[j] += static_cast<std::uint32_t>(static_cast<std::int32_t>(B[k*ldb + j]));
+    for (std::size_t j = 0; j < N; ++j)
+        correction[j] *= static_cast<std::uint32_t>(kernel.a_offset);
+
+    for (std::size_t i = 0; i < M; ++i)
+        for (std::size_t j = 0; j < N; ++j)
+            C[i*ldc + j] = static_cast<std::int32_t>(static_cast<std::uint32_t>(C[i*ldc + j]) - correction[j]);
+}
+
+template<typename T>
+void multiply_quantized(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    std::int32_t* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K
+) {
+    static const std::vector<QuantKernel<T>> kernels = available_quant_kernels<T>();
+
+    if (kernels.empty())
+        multiply_quantized_reference(A, lda, B, ldb, C, ldc, M, N, K);
+    else
+        multiply_quantized(kernels.front(), QUANT_BLOCKING, A, lda, B, ldb, C, ldc, M, N, K);
+}
+
+} // namespace gemm
@@ -0,0 +1,166 @@
+// Quantized tile kernels, included by qgemm.h once per instruction set right
+// after that set's widening policies, under the same #pragma GCC target.
+// No #pragma once, and no #includes: everything it needs comes from qgemm.h.
+//
+// A is int8 or int16, C is int32. Both packs keep K in groups of V::group
+// consecutive values that together fill one 32-bit lane: the microkernel
+// broadcasts one A group per row and the widening multiply-add (pmaddwd,
+// vpdpbusd) multiplies it against one B group per output column and sums
+// the group into that column's int32 accumulator.
+//
+// A policy V provides:
+//     type               integer vector of `width` int32 lanes
+//     a_type, b_type     pack element types
+//     group              K values per 32-bit lane
+//     a_offset           added to A while packing (128 makes int8 unsigned
+//                        for vpdpbusd; the driver subtracts it back out)
+//     zero, load, broadcast, dot, add_to
+
+// Packs MR rows of A as [group][MR][V::group]. Rows past `rows` and K past
+// K_blk are packed as zeros.
+template<typename T, std::size_t MR, typename V>
+void qpack_a(
+    const T* A, std::size_t lda,
+    typename V::a_type* pack, std::size_t K_blk, std::size_t rows
+) {
+    using a_type = typename V::a_type;
+    constexpr std::size_t G = V::group;
+    const std::size_t groups = (K_blk + G - 1) / G;
+
+    for (std::size_t g = 0; g < groups; ++g)
+        for (std::size_t r = 0; r < MR; ++r)
+            for (std::size_t e = 0; e < G; ++e) {
+                const std::size_t k = g*G + e;
+                pack[(g*MR + r)*G + e] = r < rows && k < K_blk
+                    ? static_cast<a_type>(A[r*lda + k] + V::a_offset)
+                    : a_type(0);
+            }
+}
+
+// Packs the K_blk x cols block of B into NR-column panels, each stored
+// [group][NR][V::group]. Missing columns and K past K_blk are zeros, which
+// also keeps them out of the a_offset correction.
+template<typename T, std::size_t NR, typename V>
+void qpack_b(
+    const T* B, std::size_t ldb,
+    typename V::b_type* pack, std::size_t K_blk, std::size_t cols
+) {
+    using b_type = typename V::b_type;
+    constexpr std::size_t G = V::group;
+    const std::size_t groups = (K_blk + G - 1) / G;
+
+    for (std::size_t j = 0; j < cols; j += NR) {
+        b_type* panel = pack + j * groups * G;
+        for (std::size_t g = 0; g < groups; ++g)
+            for (std::size_t c = 0; c < NR; ++c)
+                for (std::size_t e = 0; e < G; ++e) {
+                    const std::size_t k = g*G + e;
+                    panel[(g*NR + c)*G + e] = j + c < cols && k < K_blk
+                        ? static_cast<b_type>(B[k*ldb + j + c])
+                        : b_type(0);
+                }
+    }
+}
+
+// MR x NR block of C from `groups` packed K groups, same register blocking
+// as the int32 microkernel in tile.inl.
+template<std::size_t MR, std::size_t NR, typename V>
+void qmicrokernel(
+    const typename V::a_type* A_pack,
+    const typename V::b_type* B_pack,
+    std::int32_t* C, std::size_t ldc,
+    std::size_t groups
+) {
+    using vec_t = typename V::type;
+    constexpr std::size_t G = V::group;
+    constexpr std::size_t W = V::width;
+    constexpr std::size_t NV = NR / W;
+    static_assert(NR % W == 0, "NR must be a multiple of the vector width");
+
+    vec_t c[MR][NV];
+    #pragma GCC unroll 16
+    for (std::size_t r = 0; r < MR; ++r)
+        #pragma GCC unroll 16
+        for (std::size_t v = 0; v < NV; ++v)
+            V::zero(c[r][v]);
+
+    for (std::size_t g = 0; g < groups; ++g) {
+        vec_t b[NV];
+        #pragma GCC unroll 16
+        for (std::size_t v = 0; v < NV; ++v)
+            V::load(b[v], B_pack + (g*NR + v*W)*G);
+
+        #pragma GCC unroll 16
+        for (std::size_t r = 0; r < MR; ++r) {
+            vec_t a;
+            V::broadcast(a, A_pack + (g*MR + r)*G);
+            #pragma GCC unroll 16
+            for (std::size_t v = 0; v < NV; ++v)
+                V::dot(c[r][v], a, b[v]);
+        }
+    }
+
+    #pragma GCC unroll 16
+    for (std::size_t r = 0; r < MR; ++r)
+        #pragma GCC unroll 16
+        for (std::size_t v = 0; v < NV; ++v)
+            V::add_to(C + r*ldc + v*W, c[r][v]);
+}
+
+// Computes C[ii..i_end, jj..j_end] += A * B over every kc slice of K. kc
+// must be a multiple of V::group. A_pack holds MR x kc elements of a_type,
+// B_pack kc x round_up(j_end - jj, NR) of b_type.
+template<typename T, std::size_t MR, std::size_t NR, typename V>
+void qmul_tile(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    std::int32_t* C, std::size_t ldc,
+    std::size_t ii, std::size_t i_end,
+    std::size_t jj, std::size_t j_end,
+    std::size_t K, std::size_t kc,
+    void* A_pack, void* B_pack
+) {
+    using a_type = typename V::a_type;
+    using b_type = typename V::b_type;
+    constexpr std::size_t G = V::group;
+
+    a_type* a_pack = static_cast<a_type*>(A_pack);
+    b_type* b_pack = static_cast<b_type*>(B_pack);
+
+    for (std::size_t kk = 0; kk < K; kk += kc) {
+        const std::size_t K_blk  = std::min(kk + kc, K) - kk;
+        const std::size_t groups = (K_blk + G - 1) / G;
+
+        qpack_b<T, NR, V>(B + kk*ldb + jj, ldb, b_pack, K_blk, j_end - jj);
+
+        for (std::size_t i = ii; i < i_end; i += MR) {
+            const std::size_t rows = std::min(MR, i_end - i);
+            qpack_a<T, MR, V>(A + i*lda + kk, lda, a_pack, K_blk, rows);
+
+            for (std::size_t j = jj; j < j_end; j += NR) {
+                const std::size_t cols = std::min(NR, j_end - j);
+                const b_type* panel = b_pack + (j - jj) * groups * G;
+
+                if (rows == MR && cols == NR) [[likely]] {
+                    qmicrokernel<MR, NR, V>(a_pack, panel, C + i*ldc + j, ldc, groups);
+                } else {
+                    alignas(64) std::int32_t tile[MR * NR] = {};
+                    qmicrokernel<MR, NR, V>(a_pack, panel, tile, NR, groups);
+
+                    for (std::size_t r = 0; r < rows; ++r)
+                        for (std::size_t c = 0; c < cols; ++c)
+                            C[(i + r)*ldc + j + c] += tile[r*NR + c];
+                }
+            }
+        }
+    }
+}
+
+// Registers the policy's kernel for input type T under `name`.
+template<typename T, typename V>
+void append_quant_kernel(std::vector<QuantKernel<T>>& kernels, const char* name) {
+    constexpr std::size_t MR = 4;
+    constexpr std::size_t NR = 2 * V::width;
+
+    kernels.push_back(QuantKernel<T>{name, MR, NR, V::a_offset, &qmul_tile<T, MR, NR, V>});
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "matrix.h"
+#include "qgemm.h"
+
+// Symmetric per-matrix quantization: the real value of element q is
+// scale * q. T is int8_t or int16_t; products accumulate in int32, so a
+// product is refused when K * max|A| * max|B| could overflow that. This
+// is no limit for int8 (K up to ~133k at full scale), but full-scale
+// int16 only fits K <= 2: scale int16 values down to use it.
+template<typename T>
+class QuantizedMatrix {
+private:
+
+    Matrix<T> values_;
+    float scale_ = 1.0f;
+    std::int64_t max_abs_ = 0;     // largest |value|
+
+    void check_product(const QuantizedMatrix& other) const {
+        if (values_.cols() != other.values_.rows())
+            throw std::invalid_argument("inner dimensions do not match");
+        if (std::int64_t(values_.cols()) * max_abs_ * other.max_abs_ > std::numeric_limits<std::int32_t>::max())
+            throw std::overflow_error("int32 accumulators could overflow");
+    }
+
+public:
+
+    QuantizedMatrix() = default;
+
+    QuantizedMatrix(Matrix<T> values, float scale)
+        : values_(std::move(values))
+        , scale_(scale) {
+        for (std::size_t i = 0; i < values_.rows() * values_.cols(); ++i)
+            max_abs_ = std::max(max_abs_, std::abs(std::int64_t(values_.data()[i])));
+    }
+
+    // Scales so the largest magnitude maps to the largest T, then rounds.
+    // NaN and inf have no quantized value.
+    static QuantizedMatrix quantize(const Matrix<float>& real) {
+        constexpr float limit = std::numeric_limits<T>::max();
+
+        float max_abs = 0.0f;
+        for (std::size_t i = 0; i < real.rows() * real.cols(); ++i) {
+            if (!std::isfinite(real.data()[i]))
+                throw std::invalid_argument("matrix has non-finite values");
+            max_abs = std::max(max_abs, std::abs(real.data()[i]));
+        }
+
+        const float scale = max_abs > 0.0f ? max_abs / limit : 1.0f;
+
+        Matrix<T> values(real.rows(), real.cols());
+        for (std::size_t i = 0; i < real.rows() * real.cols(); ++i)
+            values.data()[i] = static_cast<T>(std::clamp(std::round(real.data()[i] / scale), -limit, limit));
+
+        return QuantizedMatrix(std::move(values), scale);
+    }
+
+    const Matrix<T>& values() const { return values_; }
+    float scale() const { return scale_; }
+
+    // Raw int32 accumulators of values() * other.values().
+    Matrix<std::int32_t> mul_int32(const QuantizedMatrix& other) const {
+        check_product(other);
+
+        Matrix<std::int32_t> product(values_.rows(), other.values_.cols());
+        gemm::multiply_quantized(
+            values_.data(), values_.cols(),
+            other.values_.data(), other.values_.cols(),
+            product.data(), product.cols(),
+            values_.rows(), other.values_.cols(), values_.cols()
+        );
+        return product;
+    }
+
+    // mul_int32 through the scalar reference loop.
+    Matrix<std::int32_t> mul_reference(const QuantizedMatrix& other) const {
+        check_product(other);
+
+        Matrix<std::int32_t> product(values_.rows(), other.values_.cols());
+        gemm::multiply_quantized_reference(
+            values_.data(), values_.cols(),
+            other.values_.data(), other.values_.cols(),
+            product.data(), product.cols(),
+            values_.rows(), other.values_.cols(), values_.cols()
+        );
+        return product;
+    }
+
+    // The product in real units: scale() * other.scale() * mul_int32.
+    Matrix<float> mul(const QuantizedMatrix& other) const {
+        const Matrix<std::int32_t> accumulators = mul_int32(other);
+        const float scale = scale_ * other.scale_;
+
+        Matrix<float> product(accumulators.rows(), accumulators.cols());
+        for (std::size_t i = 0; i < product.rows() * product.cols(); ++i)
+            product.data()[i] = scale * static_cast<float>(accumulators.data()[i]);
+        return product;
+    }
+};
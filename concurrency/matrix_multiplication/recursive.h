@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "tune.h"
+
+// Divide and conquer variants of C[M x N] += A[M x K] * B[K x N] for
+// matrices too large for the tiled loop to stay in cache. Both bottom out
+// in gemm::multiply with the given kernel and blocking once every dimension
+// is at most `leaf`.
+namespace gemm {
+
+constexpr std::size_t DEFAULT_LEAF = 256;
+
+// Cache-oblivious recursion: halve the largest of M, N and K until the
+// sub-problem fits a leaf. Splitting K gives two products accumulated into
+// the same C, one after the other.
+template<typename T>
+void multiply_recursive(
+    const Config<T>& config,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K,
+    std::size_t leaf = DEFAULT_LEAF
+) {
+    if (M == 0 || N == 0 || K == 0)
+        return;
+
+    if (std::max({M, N, K}) <= leaf) {
+        multiply(config.kernel, config.blocking, A, lda, B, ldb, C, ldc, M, N, K);
+        return;
+    }
+
+    if (M >= N && M >= K) {
+        const std::size_t m = M / 2;
+        multiply_recursive(config, A,         lda, B, ldb, C,         ldc, m,     N, K, leaf);
+        multiply_recursive(config, A + m*lda, lda, B, ldb, C + m*ldc, ldc, M - m, N, K, leaf);
+    } else if (N >= K) {
+        const std::size_t n = N / 2;
+        multiply_recursive(config, A, lda, B,     ldb, C,     ldc, M, n,     K, leaf);
+        multiply_recursive(config, A, lda, B + n, ldb, C + n, ldc, M, N - n, K, leaf);
+    } else {
+        const std::size_t k = K / 2;
+        multiply_recursive(config, A,     lda, B,         ldb, C, ldc, M, N, k,     leaf);
+        multiply_recursive(config, A + k, lda, B + k*ldb, ldb, C, ldc, M, N, K - k, leaf);
+    }
+}
+
+namespace detail {
+
+// D = X + Y, or X - Y when subtract is set, over rows x cols blocks.
+template<typename T>
+void combine(
+    T* D, std::size_t ldd,
+    const T* X, std::size_t ldx,
+    const T* Y, std::size_t ldy,
+    std::size_t rows, std::size_t cols,
+    bool subtract
+) {
+    for (std::size_t r = 0; r < rows; ++r)
+        for (std::size_t c = 0; c < cols; ++c)
+            D[r*ldd + c] = subtract ? X[r*ldx + c] - Y[r*ldy + c]
+                                    : X[r*ldx + c] + Y[r*ldy + c];
+}
+
+// D += X over rows x cols blocks.
+template<typename T>
+void accumulate(
+    T* D, std::size_t ldd,
+    const T* X, std::size_t ldx,
+    std::size_t rows, std::size_t cols
+) {
+    for (std::size_t r = 0; r < rows; ++r)
+        for (std::size_t c = 0; c < cols; ++c)
+            D[r*ldd + c] += X[r*ldx + c];
+}
+
+} // namespace detail
+
+// Strassen-Winograd: `levels` times, replace the eight half-size products
+// by seven (and fifteen block additions), then continue with
+// multiply_recursive. Odd M, N or K are handled by running the scheme on
+// the even leading part and adding the last row, column and K slice with
+// ordinary products.
+//
+// There is no division or rounding anywhere, so integer results are exact
+// as long as the block sums (at most four operand blocks added together per
+// level) do not overflow T. Floating point results differ from mul_simd in
+// the last bits, as with any reassociation.
+template<typename T>
+void multiply_strassen(
+    const Config<T>& config,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K,
+    std::size_t leaf = DEFAULT_LEAF,
+    std::size_t levels = 1
+) {
+    if (levels == 0 || std::min({M, N, K}) / 2 < leaf) {
+        multiply_recursive(config, A, lda, B, ldb, C, ldc, M, N, K, leaf);
+        return;
+    }
+
+    const std::size_t m = M / 2;
+    const std::size_t n = N / 2;
+    const std::size_t k = K / 2;
+
+    const T* A11 = A;         const T* A12 = A + k;
+    const T* A21 = A + m*lda; const T* A22 = A + m*lda + k;
+    const T* B11 = B;         const T* B12 = B + n;
+    const T* B21 = B + k*ldb; const T* B22 = B + k*ldb + n;
+    T* C11 = C;               T* C12 = C + n;
+    T* C21 = C + m*ldc;       T* C22 = C + m*ldc + n;
+
+    // S blocks are m x k, T blocks k x n, all packed with their own width.
+    std::vector<T> S1(m * k), S2(m * k), S3(m * k), S4(m * k);
+    std::vector<T> T1(k * n), T2(k * n), T3(k * n), T4(k * n);
+    std::vector<T> X(m * n), Y(m * n);
+
+    detail::combine(S1.data(), k, A21, lda, A22, lda, m, k, false);           // A21 + A22
+    detail::combine(S2.data(), k, S1.data(), k, A11, lda, m, k, true);        // S1 - A11
+    detail::combine(S3.data(), k, A11, lda, A21, lda, m, k, true);            // A11 - A21
+    detail::combine(S4.data(), k, A12, lda, S2.data(), k, m, k, true);        // A12 - S2
+
+    detail::combine(T1.data(), n, B12, ldb, B11, ldb, k, n, true);            // B12 - B11
+    detail::combine(T2.data(), n, B22, ldb, T1.data(), n, k, n, true);        // B22 - T1
+    detail::combine(T3.data(), n, B22, ldb, B12, ldb, k, n, true);            // B22 - B12
+    detail::combine(T4.data(), n, B21, ldb, T2.data(), n, k, n, true);        // B21 - T2, i.e. -T4
+
+    const auto product = [&](const T* P, std::size_t ldp, const T* Q, std::size_t ldq, T* R, std::size_t ldr) {
+        multiply_strassen(config, P, ldp, Q, ldq, R, ldr, m, n, k, leaf, levels - 1);
+    };
+
+    // X = P1 = A11 B11, then C11 += P1 + P2.
+    product(A11, lda, B11, ldb, X.data(), n);
+    detail::accumulate(C11, ldc, X.data(), n, m, n);
+    product(A12, lda, B21, ldb, C11, ldc);
+
+    // X = U2 = P1 + P6. C12 += U2 + P5 + P3 and C22 += P5.
+    product(S2.data(), k, T2.data(), n, X.data(), n);
+    product(S1.data(), k, T1.data(), n, Y.data(), n);
+    detail::accumulate(C12, ldc, X.data(), n, m, n);
+    detail::accumulate(C12, ldc, Y.data(), n, m, n);
+    detail::accumulate(C22, ldc, Y.data(), n, m, n);
+    product(S4.data(), k, B22, ldb, C12, ldc);
+
+    // X = U3 = U2 + P7. C21 += U3 - P4 and C22 += U3.
+    product(S3.data(), k, T3.data(), n, X.data(), n);
+    detail::accumulate(C21, ldc, X.data(), n, m, n);
+    detail::accumulate(C22, ldc, X.data(), n, m, n);
+    product(A22, lda, T4.data(), n, C21, ldc);
+
+    // Leftovers of odd dimensions: the last K slice over all of C, then the
+    // last row and the last column of C over the even part of K.
+    if (K % 2 != 0)
+        multiply_recursive(config, A + 2*k, lda, B + 2*k*ldb, ldb, C, ldc, M, N, 1, leaf);
+    if (M % 2 != 0)
+        multiply_recursive(config, A + 2*m*lda, lda, B, ldb, C + 2*m*ldc, ldc, 1, N, 2*k, leaf);
+    if (N % 2 != 0)
+        multiply_recursive(config, A, lda, B + 2*n, ldb, C + 2*n, ldc, 2*m, 1, 2*k, leaf);
+}
+
+} // namespace gemm
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "pool.h"
+
+// Counter-based random numbers for filling benchmark inputs. Philox4x32-10
+// (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3") turns a
+// 128-bit counter and a 64-bit key into four 32-bit outputs with ten rounds
+// of multiplies and xors. Element i of a stream is word i % 4 of the block
+// at counter i / 4, keyed by the seed, so any range of the stream can be
+// generated on its own: fills are reproducible from the seed and give the
+// same result however they are split across threads or SIMD lanes.
+namespace rng {
+
+constexpr std::uint32_t PHILOX_M0 = 0xD2511F53;
+constexpr std::uint32_t PHILOX_M1 = 0xCD9E8D57;
+constexpr std::uint32_t PHILOX_W0 = 0x9E3779B9;
+constexpr std::uint32_t PHILOX_W1 = 0xBB67AE85;
+
+// Blocks generated together; 16 x 32 bits fills one AVX-512 register per
+// counter word, and narrower targets split the vectors.
+constexpr std::size_t PHILOX_LANES = 16;
+
+// Outputs per generate() call.
+constexpr std::size_t PHILOX_CHUNK = PHILOX_LANES * 4;
+
+// Philox4x32-10 of a full 128-bit counter and 64-bit key, one block at a
+// time, written as in the paper; the known-answer vectors of Random123
+// check this, and this checks generate().
+inline void philox4x32(const std::uint32_t counter[4], const std::uint32_t key[2], std::uint32_t out[4]) {
+    std::uint32_t c[4];
+    std::copy_n(counter, 4, c);
+    std::uint32_t k0 = key[0];
+    std::uint32_t k1 = key[1];
+
+    for (int round = 0; round < 10; ++round) {
+        const std::uint64_t p0 = std::uint64_t(PHILOX_M0) * c[0];
+        const std::uint64_t p1 = std::uint64_t(PHILOX_M1) * c[2];
+
+        const std::uint32_t next[4] = {
+            static_cast<std::uint32_t>(p1 >> 32) ^ c[1] ^ k0,
+            static_cast<std::uint32_t>(p1),
+            static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k1,
+            static_cast<std::uint32_t>(p0),
+        };
+        std::copy_n(next, 4, c);
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    std::copy_n(c, 4, out);
+}
+
+// The four output words of block `counter` of stream `key`, as generate()
+// lays them out.
+inline void philox4x32(std::uint64_t counter, std::uint64_t key, std::uint32_t out[4]) {
+    const std::uint32_t c[4] = {
+        static_cast<std::uint32_t>(counter), static_cast<std::uint32_t>(counter >> 32), 0, 0
+    };
+    const std::uint32_t k[2] = {static_cast<std::uint32_t>(key), static_cast<std::uint32_t>(key >> 32)};
+    philox4x32(c, k, out);
+}
+
+// PHILOX_CHUNK consecutive outputs starting at block `counter`, computed
+// for PHILOX_LANES blocks at once in GCC vectors: each counter word is one
+// vector, and the 32 x 32 -> 64 bit multiplies run on widened copies.
+inline void generate(std::uint64_t counter, std::uint64_t key, std::uint32_t out[PHILOX_CHUNK]) {
+    typedef std::uint32_t u32v __attribute__((vector_size(PHILOX_LANES * 4)));
+    typedef std::uint64_t u64v __attribute__((vector_size(PHILOX_LANES * 8)));
+
+    u32v c0, c1;
+    for (std::size_t l = 0; l < PHILOX_LANES; ++l) {
+        c0[l] = static_cast<std::uint32_t>(counter + l);
+        c1[l] = static_cast<std::uint32_t>((counter + l) >> 32);
+    }
+    u32v c2 = {};
+    u32v c3 = {};
+
+    std::uint32_t k0 = static_cast<std::uint32_t>(key);
+    std::uint32_t k1 = static_cast<std::uint32_t>(key >> 32);
+
+    for (int round = 0; round < 10; ++round) {
+        const u64v p0 = __builtin_convertvector(c0, u64v) * std::uint64_t(PHILOX_M0);
+        const u64v p1 = __builtin_convertvector(c2, u64v) * std::uint64_t(PHILOX_M1);
+
+        const u32v hi0 = __builtin_convertvector(p0 >> 32, u32v);
+        const u32v hi1 = __builtin_convertvector(p1 >> 32, u32v);
+
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = __builtin_convertvector(p1, u32v);
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = __builtin_convertvector(p0, u32v);
+
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    for (std::size_t l = 0; l < PHILOX_LANES; ++l) {
+        out[l*4 + 0] = c0[l];
+        out[l*4 + 1] = c1[l];
+        out[l*4 + 2] = c2[l];
+        out[l*4 + 3] = c3[l];
+    }
+}
+
+// Writes elements [first, first + count) of stream `seed` to out, mapped
+// to integers uniform in [lower_bound, upper_bound] by multiply-shift
+// (bias below 2^-32 * range, irrelevant for benchmark inputs). The range
+// must fit in 32 bits.
+template<typename T>
+void fill_uniform(
+    T* out, std::size_t count,
+    std::int64_t lower_bound, std::int64_t upper_bound,
+    std::uint64_t seed, std::size_t first = 0
+) {
+    const std::uint64_t range = static_cast<std::uint64_t>(upper_bound - lower_bound) + 1;
+
+    alignas(64) std::uint32_t bits[PHILOX_CHUNK];
+
+    std::size_t i = 0;
+    while (i < count) {
+        const std::size_t element = first + i;
+        const std::size_t chunk = element / PHILOX_CHUNK;
+        const std::size_t offset = element % PHILOX_CHUNK;
+        const std::size_t n = std::min(PHILOX_CHUNK - offset, count - i);
+
+        generate(chunk * PHILOX_LANES, seed, bits);
+
+        for (std::size_t j = 0; j < n; ++j)
+            out[i + j] = static_cast<T>(lower_bound + static_cast<std::int64_t>((bits[offset + j] * range) >> 32));
+
+        i += n;
+    }
+}
+
+// fill_uniform split into one contiguous, chunk aligned range per worker.
+// The result does not depend on the number of workers.
+template<typename T>
+void fill_uniform_parallel(
+    T* out, std::size_t count,
+    std::int64_t lower_bound, std::int64_t upper_bound,
+    std::uint64_t seed, WorkerPool& pool
+) {
+    pool.run([&](std::size_t worker, std::size_t worker_count) {
+        const std::size_t chunks = (count + PHILOX_CHUNK - 1) / PHILOX_CHUNK;
+        const std::size_t per_worker = (chunks + worker_count - 1) / worker_count;
+
+        const std::size_t begin = std::min(count, worker * per_worker * PHILOX_CHUNK);
+        const std::size_t end   = std::min(count, (worker + 1) * per_worker * PHILOX_CHUNK);
+        if (begin < end)
+            fill_uniform(out + begin, end - begin, lower_bound, upper_bound, seed, begin);
+    });
+}
+
+// Default seeds for make_random: a fixed sequence, so a benchmark that
+// creates its inputs in the same order gets the same inputs every run,
+// while two matrices made one after the other still differ.
+inline std::uint64_t next_seed() {
+    static std::atomic<std::uint64_t> sequence{0};
+    std::uint64_t z = sequence.fetch_add(1, std::memory_order_relaxed) + 0x9E3779B97F4A7C15;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+} // namespace rng
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "gemm.h"
+#include "mat.h"
+#include "matrix.h"
+#include "pool.h"
+
+// Compressed sparse row storage for operands that are mostly zeros. Row r
+// owns values_[row_ptr_[r] .. row_ptr_[r + 1]), and col_idx_ holds the
+// column of each stored value. Column indices are 32 bits to halve their
+// share of the memory traffic, which caps cols() at 2^32 - 1.
+//
+// mul_vector (SpMV) gathers x through the column indices into SIMD
+// vectors; mul_dense (SpMM) scales whole rows of the dense operand, so its
+// inner loop is as contiguous as mul_simd's. The parallel overloads split
+// rows into one block per worker with about the same number of non-zeros,
+// not the same number of rows, so a few dense rows do not stall a worker.
+template<typename T>
+class SparseMatrix {
+private:
+
+    using simd_t = stdx::native_simd<T>;
+    using V = gemm::NativeVec<T>;
+
+    // Columns of C held in registers per pass of mul_dense.
+    constexpr static std::size_t SPMM_VECTORS = 4;
+
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::vector<std::size_t> row_ptr_{0};
+    std::vector<std::uint32_t> col_idx_;
+    std::vector<T> values_;
+
+    // First row of block `worker` out of `worker_count`, balanced by nnz.
+    std::size_t row_split(std::size_t worker, std::size_t worker_count) const {
+        if (worker >= worker_count)
+            return rows_;
+
+        const std::size_t target = nnz() * worker / worker_count;
+        return std::lower_bound(row_ptr_.begin(), row_ptr_.begin() + rows_, target) - row_ptr_.begin();
+    }
+
+    // y[r] = row r . x for r in [begin, end).
+    void spmv_rows(const T* x, T* y, std::size_t begin, std::size_t end) const {
+        constexpr std::size_t W = simd_t::size();
+
+        for (std::size_t r = begin; r < end; ++r) {
+            const std::size_t k_end = row_ptr_[r + 1];
+            std::size_t k = row_ptr_[r];
+
+            simd_t acc(T(0));
+            for (; k + W <= k_end; k += W) {
+                simd_t v;
+                V::loadu(v, values_.data() + k);
+                const simd_t gathered([&](auto lane) { return x[col_idx_[k + lane]]; });
+                acc += v * gathered;
+            }
+
+            T sum = stdx::reduce(acc);
+            for (; k < k_end; ++k)
+                sum += values_[k] * x[col_idx_[k]];
+
+            y[r] = sum;
+        }
+    }
+
+    // C[r, 0..n) = row r * B for r in [begin, end). Each pass keeps
+    // SPMM_VECTORS vectors of a C row in registers and streams the row's
+    // non-zeros against the matching rows of B.
+    void spmm_rows(
+        const T* B, std::size_t ldb,
+        T* C, std::size_t ldc,
+        std::size_t n,
+        std::size_t begin, std::size_t end
+    ) const {
+        constexpr std::size_t W = simd_t::size();
+        constexpr std::size_t NB = SPMM_VECTORS * W;
+
+        for (std::size_t r = begin; r < end; ++r) {
+            const std::size_t k_begin = row_ptr_[r];
+            const std::size_t k_end = row_ptr_[r + 1];
+            T* c_row = C + r*ldc;
+
+            std::size_t j = 0;
+            for (; j + NB <= n; j += NB) {
+                simd_t acc[SPMM_VECTORS];
+                #pragma GCC unroll 16
+                for (std::size_t v = 0; v < SPMM_VECTORS; ++v)
+                    V::broadcast(acc[v], T(0));
+
+                for (std::size_t k = k_begin; k < k_end; ++k) {
+                    simd_t a;
+                    V::broadcast(a, values_[k]);
+                    const T* b_row = B + col_idx_[k]*ldb + j;
+
+                    #pragma GCC unroll 16
+                    for (std::size_t v = 0; v < SPMM_VECTORS; ++v) {
+                        simd_t b;
+                        V::loadu(b, b_row + v*W);
+                        acc[v] += a * b;
+                    }
+                }
+
+                #pragma GCC unroll 16
+                for (std::size_t v = 0; v < SPMM_VECTORS; ++v)
+                    V::storeu(c_row + j + v*W, acc[v]);
+            }
+
+            // Columns past the last full pass, one at a time.
+            const std::size_t tail = n - j;
+            std::fill_n(c_row + j, tail, T(0));
+            for (std::size_t k = k_begin; k < k_end; ++k) {
+                const T a = values_[k];
+                const T* b_row = B + col_idx_[k]*ldb + j;
+                for (std::size_t c = 0; c < tail; ++c)
+                    c_row[j + c] += a * b_row[c];
+            }
+        }
+    }
+
+public:
+
+    SparseMatrix() = default;
+
+    // Keeps the non-zero elements of a rows x cols row-major array.
+    static SparseMatrix from_dense(const T* data, std::size_t rows, std::size_t cols, std::size_t ld) {
+        if (cols > std::numeric_limits<std::uint32_t>::max())
+            throw std::invalid_argument("too many columns for 32-bit indices");
+
+        SparseMatrix sparse;
+        sparse.rows_ = rows;
+        sparse.cols_ = cols;
+        sparse.row_ptr_.reserve(rows + 1);
+
+        for (std::size_t r = 0; r < rows; ++r) {
+            for (std::size_t c = 0; c < cols; ++c) {
+                const T value = data[r*ld + c];
+                if (value != T(0)) {
+                    sparse.col_idx_.push_back(static_cast<std::uint32_t>(c));
+                    sparse.values_.push_back(value);
+                }
+            }
+            sparse.row_ptr_.push_back(sparse.values_.size());
+        }
+
+        return sparse;
+    }
+
+    template<std::size_t N>
+    static SparseMatrix from_dense(const SquareMatrix<T, N>& dense) {
+        return from_dense(dense.data(), N, N, N);
+    }
+
+    static SparseMatrix from_dense(const Matrix<T>& dense) {
+        return from_dense(dense.data(), dense.rows(), dense.cols(), dense.cols());
+    }
+
+    std::size_t rows() const { return rows_; }
+    std::size_t cols() const { return cols_; }
+    std::size_t nnz() const { return values_.size(); }
+
+    double density() const {
+        return rows_ * cols_ == 0 ? 0.0 : static_cast<double>(nnz()) / (rows_ * cols_);
+    }
+
+    std::vector<T> mul_vector(const std::vector<T>& x) const {
+        if (x.size() != cols_)
+            throw std::invalid_argument("inner dimensions do not match");
+
+        std::vector<T> y(rows_);
+        spmv_rows(x.data(), y.data(), 0, rows_);
+        return y;
+    }
+
+    std::vector<T> mul_vector(const std::vector<T>& x, WorkerPool& pool) const {
+        if (x.size() != cols_)
+            throw std::invalid_argument("inner dimensions do not match");
+
+        std::vector<T> y(rows_);
+        pool.run([&](std::size_t worker, std::size_t worker_count) {
+            spmv_rows(x.data(), y.data(), row_split(worker, worker_count), row_split(worker + 1, worker_count));
+        });
+        return y;
+    }
+
+    Matrix<T> mul_dense(const Matrix<T>& other) const {
+        if (cols_ != other.rows())
+            throw std::invalid_argument("inner dimensions do not match");
+
+        Matrix<T> product(rows_, other.cols(), other.backing());
+        spmm_rows(other.data(), other.cols(), product.data(), product.cols(), other.cols(), 0, rows_);
+        return product;
+    }
+
+    Matrix<T> mul_dense(const Matrix<T>& other, WorkerPool& pool) const {
+        if (cols_ != other.rows())
+            throw std::invalid_argument("inner dimensions do not match");
+
+        Matrix<T> product(rows_, other.cols(), other.backing());
+        pool.run([&](std::size_t worker, std::size_t worker_count) {
+            spmm_rows(
+                other.data(), other.cols(), product.data(), product.cols(), other.cols(),
+                row_split(worker, worker_count), row_split(worker + 1, worker_count)
+            );
+        });
+        return product;
+    }
+
+    template<std::size_t N>
+    SquareMatrix<T, N> mul_dense(const SquareMatrix<T, N>& other) const {
+        if (rows_ != N || cols_ != N)
+            throw std::invalid_argument("matrix is not N x N");
+
+        SquareMatrix<T, N> product;
+        spmm_rows(other.data(), N, product.data(), N, N, 0, N);
+        return product;
+    }
+
+    template<std::size_t N>
+    SquareMatrix<T, N> mul_dense(const SquareMatrix<T, N>& other, WorkerPool& pool) const {
+        if (rows_ != N || cols_ != N)
+            throw std::invalid_argument("matrix is not N x N");
+
+        SquareMatrix<T, N> product;
+        pool.run([&](std::size_t worker, std::size_t worker_count) {
+            spmm_rows(
+                other.data(), N, product.data(), N, N,
+                row_split(worker, worker_count), row_split(worker + 1, worker_count)
+            );
+        });
+        return product;
+    }
+};
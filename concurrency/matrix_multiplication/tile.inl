@@ -0,0 +1,245 @@
+// Tile kernels, included once per instruction set. gemm.h includes this
+// into namespace gemm for the build's own target; dispatch.h includes it
+// again into gemm::<isa> under #pragma GCC target, so every function here,
+// including the GccVec helpers, is compiled for that ISA directly rather
+// than inlined into it from a baseline build. No #pragma once, and no
+// #includes: everything it needs comes from gemm.h.
+
+template<typename T, std::size_t Bytes>
+struct GccVec {
+    typedef T type __attribute__((vector_size(Bytes)));
+    typedef T unaligned_type __attribute__((vector_size(Bytes), aligned(alignof(T))));
+    constexpr static std::size_t width = Bytes / sizeof(T);
+
+    static void load(type& v, const T* p) { v = *reinterpret_cast<const type*>(p); }
+    static void loadu(type& v, const T* p) { v = *reinterpret_cast<const unaligned_type*>(p); }
+    static void broadcast(type& v, T x) { v = type{} + x; }
+    static void storeu(T* p, const type& v) { *reinterpret_cast<unaligned_type*>(p) = v; }
+};
+
+// Packs MR rows of A k-major: pack[k*MR + r] = alpha * A[r][k], so the
+// microkernel reads the MR values it broadcasts at step k from one place
+// and alpha costs nothing per product. When fewer than MR rows are left,
+// the missing ones are packed as zeros.
+template<typename T, std::size_t MR>
+void pack_a(
+    const T* A, std::size_t lda,
+    T* pack, std::size_t K_blk, std::size_t rows,
+    T alpha
+) {
+    if (rows == MR && alpha == T(1)) {
+        for (std::size_t k = 0; k < K_blk; ++k)
+            for (std::size_t r = 0; r < MR; ++r)
+                pack[k*MR + r] = A[r*lda + k];
+        return;
+    }
+
+    for (std::size_t k = 0; k < K_blk; ++k)
+        for (std::size_t r = 0; r < MR; ++r)
+            pack[k*MR + r] = r < rows ? alpha * A[r*lda + k] : T(0);
+}
+
+// Packs the K_blk x cols block of B starting at B into NR-column panels,
+// each stored k-major: panel[k*NR + c] = B[k][c]. Every row of a panel is
+// a whole number of SIMD vectors; a trailing panel narrower than NR is
+// padded with zeros.
+template<typename T, std::size_t NR>
+void pack_b(
+    const T* B, std::size_t ldb,
+    T* pack, std::size_t K_blk, std::size_t cols
+) {
+    std::size_t j = 0;
+    for (; j + NR <= cols; j += NR) {
+        T* panel = pack + j * K_blk;
+        for (std::size_t k = 0; k < K_blk; ++k)
+            std::copy_n(B + k*ldb + j, NR, panel + k*NR);
+    }
+
+    if (j == cols)
+        return;
+
+    T* panel = pack + j * K_blk;
+    for (std::size_t k = 0; k < K_blk; ++k) {
+        std::copy_n(B + k*ldb + j, cols - j, panel + k*NR);
+        std::fill(panel + k*NR + (cols - j), panel + (k + 1)*NR, T(0));
+    }
+}
+
+// Register-blocked outer product: for every k, broadcast each of the MR
+// packed A values against the NR/V::width vectors of packed B, keeping the
+// MR x NR block of C in MR * NR/V::width accumulators. Each accumulator
+// already holds whole output elements, so C is updated with plain vector
+// adds and no horizontal reduction.
+template<typename T, std::size_t MR, std::size_t NR, typename V = NativeVec<T>>
+void microkernel(
+    const T* A_pack,
+    const T* B_pack,
+    T* C, std::size_t ldc,
+    std::size_t K_blk
+) {
+    using vec_t = typename V::type;
+    constexpr std::size_t W = V::width;
+    constexpr std::size_t NV = NR / W;
+    static_assert(NR % W == 0, "NR must be a multiple of the SIMD width");
+
+    vec_t c[MR][NV] = {};
+
+    for (std::size_t k = 0; k < K_blk; ++k) {
+        vec_t b[NV];
+        #pragma GCC unroll 16
+        for (std::size_t v = 0; v < NV; ++v)
+            V::load(b[v], B_pack + k*NR + v*W);
+
+        #pragma GCC unroll 16
+        for (std::size_t r = 0; r < MR; ++r) {
+            vec_t a;
+            V::broadcast(a, A_pack[k*MR + r]);
+            #pragma GCC unroll 16
+            for (std::size_t v = 0; v < NV; ++v)
+                c[r][v] += a * b[v];
+        }
+    }
+
+    #pragma GCC unroll 16
+    for (std::size_t r = 0; r < MR; ++r) {
+        #pragma GCC unroll 16
+        for (std::size_t v = 0; v < NV; ++v) {
+            vec_t out;
+            V::loadu(out, C + r*ldc + v*W);
+            out += c[r][v];
+            V::storeu(C + r*ldc + v*W, out);
+        }
+    }
+}
+
+// Micro-tile on the M or N edge of C. The zero-padded packs let the full
+// microkernel run unchanged into a scratch tile, and only the rows x cols
+// corner that exists in C is added back.
+template<typename T, std::size_t MR, std::size_t NR, typename V = NativeVec<T>>
+void microkernel_edge(
+    const T* A_pack,
+    const T* B_pack,
+    T* C, std::size_t ldc,
+    std::size_t K_blk,
+    std::size_t rows, std::size_t cols
+) {
+    alignas(64) T tile[MR * NR] = {};
+    microkernel<T, MR, NR, V>(A_pack, B_pack, tile, NR, K_blk);
+
+    for (std::size_t r = 0; r < rows; ++r)
+        for (std::size_t c = 0; c < cols; ++c)
+            C[r*ldc + c] += tile[r*NR + c];
+}
+
+// Computes the output tile C[ii..i_end, jj..j_end] = alpha * A * B +
+// beta * C, scaling the tile by beta first and then accumulating over every
+// kc wide slice of K. A_pack holds MR x kc elements and B_pack
+// kc x round_up(j_end - jj, NR). Tiles may be cut short on the bottom and
+// right edges of C; K needs no special case since the microkernel steps
+// through it one element at a time.
+template<typename T, std::size_t MR, std::size_t NR, typename V = NativeVec<T>>
+void mul_tile(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t ii, std::size_t i_end,
+    std::size_t jj, std::size_t j_end,
+    std::size_t K, std::size_t kc,
+    T alpha, T beta,
+    T* A_pack, T* B_pack
+) {
+    // beta == 0 overwrites C without reading it, as in BLAS.
+    if (beta != T(1))
+        for (std::size_t i = ii; i < i_end; ++i)
+            for (std::size_t j = jj; j < j_end; ++j)
+                C[i*ldc + j] = beta == T(0) ? T(0) : beta * C[i*ldc + j];
+
+    if (alpha == T(0))
+        return;
+
+    for (std::size_t kk = 0; kk < K; kk += kc) {
+        const std::size_t k_end = std::min(kk + kc, K);
+
+        const std::size_t K_blk  = k_end - kk;
+
+        pack_b<T, NR>(B + kk*ldb + jj, ldb, B_pack, K_blk, j_end - jj);
+
+        for (std::size_t i = ii; i < i_end; i += MR) {
+            const std::size_t rows = std::min(MR, i_end - i);
+            pack_a<T, MR>(A + i*lda + kk, lda, A_pack, K_blk, rows, alpha);
+
+            for (std::size_t j = jj; j < j_end; j += NR) {
+                const std::size_t cols = std::min(NR, j_end - j);
+
+                if (rows == MR && cols == NR) [[likely]] {
+                    microkernel<T, MR, NR, V>(
+                        A_pack, B_pack + (j - jj)*K_blk,
+                        C + i*ldc + j, ldc,
+                        K_blk
+                    );
+                } else {
+                    microkernel_edge<T, MR, NR, V>(
+                        A_pack, B_pack + (j - jj)*K_blk,
+                        C + i*ldc + j, ldc,
+                        K_blk, rows, cols
+                    );
+                }
+            }
+        }
+    }
+}
+
+// Every micro-tile shape compiled for this ISA, the default MR x one vector
+// first. The shapes keep MR * NR/V::width accumulators within 16 vector
+// registers, the smallest file any of the tiers has.
+template<typename T, typename V>
+void append_kernels(std::vector<Kernel<T>>& kernels, const char* name) {
+    constexpr std::size_t W = V::width;
+
+    kernels.push_back(make_kernel<T, DEFAULT_MR<T>, W>(name, &mul_tile<T, DEFAULT_MR<T>, W, V>));
+    kernels.push_back(make_kernel<T, 8, W>(name, &mul_tile<T, 8, W, V>));
+    kernels.push_back(make_kernel<T, 4, 2*W>(name, &mul_tile<T, 4, 2*W, V>));
+    kernels.push_back(make_kernel<T, 6, 2*W>(name, &mul_tile<T, 6, 2*W, V>));
+}
+
+// C = A * B for `groups` groups of N x N matrices in batch layout (see
+// MatrixBatch): element (r, c) of all BATCH_LANES<T> matrices of a group is
+// one 64-byte line, lane l belonging to matrix l. Every vector op works on
+// W different matrices at once, so there is nothing to pack and no
+// horizontal step, however small N is.
+template<typename T, std::size_t N, typename V = NativeVec<T>>
+void mul_batch(const T* A, const T* B, T* C, std::size_t groups) {
+    using vec_t = typename V::type;
+    constexpr std::size_t L = BATCH_LANES<T>;
+    constexpr std::size_t W = V::width;
+    static_assert(L % W == 0, "a batch line must be a whole number of vectors");
+
+    for (std::size_t g = 0; g < groups; ++g) {
+        const T* a = A + g * N*N*L;
+        const T* b = B + g * N*N*L;
+        T* c = C + g * N*N*L;
+
+        for (std::size_t i = 0; i < N; ++i) {
+            for (std::size_t v = 0; v < L; v += W) {
+                vec_t acc[N] = {};
+
+                #pragma GCC unroll 16
+                for (std::size_t k = 0; k < N; ++k) {
+                    vec_t a_ik;
+                    V::load(a_ik, a + (i*N + k)*L + v);
+
+                    #pragma GCC unroll 16
+                    for (std::size_t j = 0; j < N; ++j) {
+                        vec_t b_kj;
+                        V::load(b_kj, b + (k*N + j)*L + v);
+                        acc[j] += a_ik * b_kj;
+                    }
+                }
+
+                #pragma GCC unroll 16
+                for (std::size_t j = 0; j < N; ++j)
+                    V::storeu(c + (i*N + j)*L + v, acc[j]);
+            }
+        }
+    }
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "dispatch.h"
+
+// Tuned kernel and blocking per element type. The autotuner in naive.cpp
+// (--tune) times candidates on the host and stores the winner in a small
+// text file, one line per type:
+//
+//     i32 avx512 6 32 192 256 512
+//     ^   ^      ^ ^  ^   ^   ^
+//     type ISA  MR NR MC  KC  NC
+//
+// The file is read the first time a type is multiplied. It is looked up in
+// $GEMM_TUNE_FILE, falling back to gemm.tune in the working directory.
+// Entries naming a kernel the running CPU cannot execute are ignored, so a
+// file copied between hosts degrades to the untuned default.
+namespace gemm {
+
+struct CacheSizes {
+    std::size_t l1d = 32 * 1024;
+    std::size_t l2  = 1024 * 1024;
+    std::size_t l3  = 8 * 1024 * 1024;
+};
+
+namespace detail {
+
+inline std::optional<std::string> read_line(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line))
+        return std::nullopt;
+    return line;
+}
+
+// sysfs sizes look like "48K" or "32M".
+inline std::size_t parse_cache_size(const std::string& text) {
+    std::size_t value = std::strtoull(text.c_str(), nullptr, 10);
+    if (text.find('K') != std::string::npos)
+        value *= 1024;
+    else if (text.find('M') != std::string::npos)
+        value *= 1024 * 1024;
+    return value;
+}
+
+} // namespace detail
+
+// Cache sizes of cpu0 as the kernel reports them. Levels sysfs does not
+// list keep the defaults above.
+inline CacheSizes detect_cache_sizes() {
+    CacheSizes sizes;
+
+    for (int index = 0; ; ++index) {
+        const std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/";
+        const auto level = detail::read_line(dir + "level");
+        const auto type  = detail::read_line(dir + "type");
+        const auto size  = detail::read_line(dir + "size");
+        if (!level || !type || !size)
+            break;
+
+        const std::size_t bytes = detail::parse_cache_size(*size);
+        if (*level == "1" && *type == "Data")
+            sizes.l1d = bytes;
+        else if (*level == "2" && *type != "Instruction")
+            sizes.l2 = bytes;
+        else if (*level == "3" && *type != "Instruction")
+            sizes.l3 = bytes;
+    }
+
+    return sizes;
+}
+
+template<typename T>
+struct Config {
+    Kernel<T> kernel;
+    Blocking blocking;
+};
+
+template<typename T>
+std::string type_key() {
+    return (std::is_floating_point_v<T> ? "f" : "i") + std::to_string(sizeof(T) * 8);
+}
+
+inline std::string tune_file_path() {
+    const char* path = std::getenv("GEMM_TUNE_FILE");
+    return path != nullptr ? path : "gemm.tune";
+}
+
+template<typename T>
+std::optional<Config<T>> load_config(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string type, name;
+        std::size_t mr, nr;
+        Blocking blocking;
+
+        if (!(fields >> type >> name >> mr >> nr >> blocking.mc >> blocking.kc >> blocking.nc))
+            continue;
+        if (type != type_key<T>() || blocking.mc == 0 || blocking.kc == 0 || blocking.nc == 0)
+            continue;
+
+        for (const Kernel<T>& kernel : available_kernels<T>())
+            if (name == kernel.name && mr == kernel.mr && nr == kernel.nr)
+                return Config<T>{kernel, blocking};
+    }
+
+    return std::nullopt;
+}
+
+// Rewrites this type's line and keeps the lines of every other type.
+template<typename T>
+void save_config(const std::string& path, const Config<T>& config) {
+    std::vector<std::string> lines;
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+            if (!line.starts_with(type_key<T>() + " "))
+                lines.push_back(line);
+    }
+
+    std::ofstream out(path, std::ios::trunc);
+    for (const std::string& line : lines)
+        out << line << '\n';
+    out << type_key<T>() << ' ' << config.kernel.name << ' '
+        << config.kernel.mr << ' ' << config.kernel.nr << ' '
+        << config.blocking.mc << ' ' << config.blocking.kc << ' ' << config.blocking.nc << '\n';
+}
+
+// Starting point for a kernel before any timing: an A strip plus one B
+// panel in half of L1d, the KC x NC block of B and the MC x NC tile of C in
+// half of L2 each. MC and NC are kept multiples of the micro-tile so only
+// the matrix edges take the edge path.
+template<typename T>
+Blocking suggest_blocking(const Kernel<T>& kernel, const CacheSizes& caches) {
+    const std::size_t kc = std::clamp<std::size_t>(
+        caches.l1d / 2 / ((kernel.mr + kernel.nr) * sizeof(T)) / 16 * 16, 16, 1024);
+    const std::size_t nc = std::clamp<std::size_t>(
+        caches.l2 / 2 / (kc * sizeof(T)) / kernel.nr * kernel.nr, kernel.nr, 1024 / kernel.nr * kernel.nr);
+    const std::size_t mc = std::clamp<std::size_t>(
+        caches.l2 / 2 / (nc * sizeof(T)) / kernel.mr * kernel.mr, kernel.mr, 256 / kernel.mr * kernel.mr);
+    return Blocking{mc, kc, nc};
+}
+
+// Blockings worth timing for a kernel: the grid below, less whatever does
+// not fit the same cache budgets suggest_blocking aims for.
+template<typename T>
+std::vector<Blocking> blocking_candidates(const Kernel<T>& kernel, const CacheSizes& caches) {
+    std::vector<Blocking> candidates{suggest_blocking(kernel, caches)};
+
+    for (std::size_t kc : {64, 128, 256, 384, 512}) {
+        if (kc * (kernel.mr + kernel.nr) * sizeof(T) > caches.l1d)
+            continue;
+
+        for (std::size_t nc : {64, 128, 256, 512, 1024}) {
+            nc = std::max(nc / kernel.nr, std::size_t{1}) * kernel.nr;
+            if (kc * nc * sizeof(T) > caches.l2)
+                continue;
+
+            for (std::size_t mc : {24, 48, 96, 192}) {
+                mc = std::max(mc / kernel.mr, std::size_t{1}) * kernel.mr;
+                if (mc * nc * sizeof(T) > caches.l2)
+                    continue;
+
+                const Blocking blocking{mc, kc, nc};
+                const bool seen = std::any_of(candidates.begin(), candidates.end(), [&](const Blocking& b) {
+                    return b.mc == mc && b.kc == kc && b.nc == nc;
+                });
+                if (!seen)
+                    candidates.push_back(blocking);
+            }
+        }
+    }
+
+    return candidates;
+}
+
+// The configuration multiply() and multiply_parallel() use without an
+// explicit kernel: the tune file's entry for T if there is a usable one,
+// otherwise the best ISA's default shape with DEFAULT_BLOCKING.
+template<typename T>
+const Config<T>& active_config() {
+    static const Config<T> config =
+        load_config<T>(tune_file_path()).value_or(Config<T>{default_kernel<T>(), DEFAULT_BLOCKING});
+    return config;
+}
+
+template<typename T>
+void multiply(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K
+) {
+    const Config<T>& config = active_config<T>();
+    multiply(config.kernel, config.blocking, A, lda, B, ldb, C, ldc, M, N, K);
+}
+
+template<typename T>
+void multiply_parallel(
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K,
+    WorkerPool& pool
+) {
+    const Config<T>& config = active_config<T>();
+    multiply_parallel(config.kernel, config.blocking, A, lda, B, ldb, C, ldc, M, N, K, pool);
+}
+
+template<typename T>
+void gemm(
+    T alpha,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T beta,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K
+) {
+    const Config<T>& config = active_config<T>();
+    gemm(config.kernel, config.blocking, alpha, A, lda, B, ldb, beta, C, ldc, M, N, K);
+}
+
+template<typename T>
+void gemm_parallel(
+    T alpha,
+    const T* A, std::size_t lda,
+    const T* B, std::size_t ldb,
+    T beta,
+    T* C, std::size_t ldc,
+    std::size_t M, std::size_t N, std::size_t K,
+    WorkerPool& pool
+) {
+    const Config<T>& config = active_config<T>();
+    gemm_parallel(config.kernel, config.blocking, alpha, A, lda, B, ldb, beta, C, ldc, M, N, K, pool);
+}
+
+} // namespace gemm
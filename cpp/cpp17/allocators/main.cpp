@@ -2,25 +2,9 @@
 #include <array>
 #include <print>
 #include <cstddef>
-#include <chrono>
 #include <memory>
 
-class [[nodiscard]] ScopeTimer {
-private:
-    std::string name_;
-    std::chrono::time_point<std::chrono::high_resolution_clock> start_;
-
-public:
-    ScopeTimer(std::string name)
-        : name_(name)
-        , start_(std::chrono::high_resolution_clock::now()) {}
-
-    ~ScopeTimer() {
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration<double, std::milli>(end - start_).count();
-        std::println("{}: {}ms", name_, (int)duration);
-    }
-};
+#include "../../../common/bench.h"
 
 template<typename T>
 class MemAudit {
@@ -170,37 +154,34 @@ bool operator!=(const PoolAllocator<T, PoolSize>& a, const PoolAllocator<U, Pool
     return !(a == b);
 }
 
-int main() {
+// Fills one vector per call, timed as a whole.
+template<typename Vector>
+void fill(std::size_t count, bool reserve) {
+    Vector vec;
+    if (reserve)
+        vec.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+        vec.emplace_back(i);
+    bench::DoNotOptimize(vec);
+}
+
+int main(int argc, char** argv) {
     constexpr std::size_t item_count = 1 << 21;
 
     using obj_t = MemAudit<char>;
-    {
-        auto _ = ScopeTimer("No alloc");
-        std::vector<obj_t>  vec;
-        for (int i = 0; i < item_count; ++i)
-            vec.emplace_back(i);
-    }
+    bench::Report report;
 
-    {
-        auto _ = ScopeTimer("No alloc + reserve");
-        std::vector<obj_t>  vec;
-        vec.reserve(item_count);
-        for (int i = 0; i < item_count; ++i)
-            vec.emplace_back(i);
-    }
+    const auto run = [&](std::string name, auto&& fn) {
+        const bench::Stats stats = bench::run(std::move(name), fn);
+        std::println("{}: {}ms (p99 {}ms)", stats.name, (int)(stats.p50 / 1e6), (int)(stats.p99 / 1e6));
+        report.add(stats);
+    };
 
-    {
-        auto _ = ScopeTimer("Custom alloc");
-        std::vector<obj_t, CustomAllocator<obj_t>>  vec;
-        for (int i = 0; i < item_count; ++i)
-            vec.emplace_back(i);
-    }
+    run("No alloc", [] { fill<std::vector<obj_t>>(item_count, false); });
+    run("No alloc + reserve", [] { fill<std::vector<obj_t>>(item_count, true); });
+    run("Custom alloc", [] { fill<std::vector<obj_t, CustomAllocator<obj_t>>>(item_count, false); });
+    run("stack alloc", [] { fill<std::vector<obj_t, PoolAllocator<obj_t, item_count << 1>>>(item_count, false); });
 
-    {
-        auto _ = ScopeTimer("stack alloc");
-        std::vector<obj_t, PoolAllocator<obj_t, item_count << 1>>  vec;
-        for (int i = 0; i < item_count; ++i)
-            vec.emplace_back(i);
-    }
+    report.save(argc, argv);
     return 0;
 }
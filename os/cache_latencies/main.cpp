@@ -1,7 +1,11 @@
 #include <iostream>
 #include <vector>
-#include <chrono>
 #include <random>
+#include <memory>
+#include <optional>
+
+#include "../../common/bench.h"
+#include "../../common/cache.h"
 
 void sequential_access(std::vector<int64_t>& arr) {
     for (size_t i = 0; i < arr.size(); ++i) {
@@ -20,15 +24,53 @@ void random_access(std::vector<int64_t>& arr, size_t access_count) {
     }
 }
 
-void flush_cache(size_t size_mb) {
-    size_t buffer_count = size_mb * 1024 * 1024;
-    std::vector<char> buffer(buffer_count);
-    for (size_t i = 0; i < buffer_count; ++i) {
-        buffer[i] = 'a';
+// random_access with each access timed on its own, in TSC ticks; the
+// fenced counter reads add a few tens of cycles to every access.
+void random_access_latencies(std::vector<int64_t>& arr, size_t access_count, bench::Histogram& ticks) {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> dis(0, arr.size() - 1);
+
+    for (size_t i = 0; i < access_count; ++i) {
+        size_t index = dis(gen);
+        const uint64_t start = bench::tsc_begin();
+        arr[index] += 1;
+        ticks.record(bench::tsc_end() - start);
     }
 }
 
-int main() {
+// Each access pattern with arr evicted from every cache level, 10 times.
+template<typename F>
+bench::Stats cold(std::string name, std::vector<int64_t>& arr, F&& fn) {
+    return bench::run_fresh(
+        std::move(name),
+        [&] { bench::evict(arr.data(), arr.size() * sizeof(int64_t)); },
+        fn,
+        bench::Options{.warmup_ms = 0, .min_time_ms = 0, .min_samples = 10, .max_samples = 10}
+    );
+}
+
+// The same with arr loaded into the smallest cache level holding it;
+// nullopt when it fits in none.
+template<typename F>
+std::optional<bench::Stats> warm(std::string name, bench::CacheState& cache, std::vector<int64_t>& arr, F&& fn) {
+    const size_t bytes = arr.size() * sizeof(int64_t);
+    std::optional<bench::CacheLevel> level;
+    for (const auto l : {bench::CacheLevel::LLC, bench::CacheLevel::L2, bench::CacheLevel::L1})
+        if (bytes < bench::cache_size(l))
+            level = l;
+    if (!level)
+        return std::nullopt;
+
+    return bench::run_fresh(
+        std::move(name),
+        [&] { cache.prime(arr.data(), bytes, *level); },
+        fn,
+        bench::Options{.warmup_ms = 0, .min_time_ms = 0, .min_samples = 10, .max_samples = 10}
+    );
+}
+
+int main(int argc, char** argv) {
     const size_t L1D_SIZE = 65536;
     const size_t L2D_SIZE = 4194304;
     const size_t L3D_SIZE = 8 * 1024 * 1024;
@@ -44,29 +86,42 @@ int main() {
         BAD_SIZE / I64_SIZE 
     };
 
+    bench::Report report;
+    bench::CacheState cache;
+    auto ticks = std::make_unique<bench::Histogram>();
+
     for (auto size: sizes) {
         std::vector<int64_t> mem(size);
         std::cout << ">>> " << size << " elements\n";
 
-        flush_cache(256);
+        const bench::Stats sequential_stats = cold("sequential/" + std::to_string(size), mem, [&] { sequential_access(mem); });
+        std::cout << "sequential access = " << sequential_stats.p50 / 1e9 << " (p99 " << sequential_stats.p99 / 1e9 << ")\n";
+        report.add(sequential_stats);
 
-        auto start = std::chrono::high_resolution_clock::now();
-        sequential_access(mem);
-        auto end = std::chrono::high_resolution_clock::now();
-        auto sequential_duration = std::chrono::duration<double>(end - start).count();
-        std::cout << "sequential access = " << sequential_duration << '\n';
+        const bench::Stats random_stats = cold("random/" + std::to_string(size), mem, [&] { random_access(mem, RANDOM_ACCESS_COUNT); });
+        std::cout << "random access     = " << random_stats.p50 / 1e9 << " (p99 " << random_stats.p99 / 1e9 << ")\n";
+        report.add(random_stats);
 
-        flush_cache(256);
+        const auto warm_stats = warm("random warm/" + std::to_string(size), cache, mem, [&] { random_access(mem, RANDOM_ACCESS_COUNT); });
+        if (warm_stats) {
+            std::cout << "random (cached)   = " << warm_stats->p50 / 1e9 << " (p99 " << warm_stats->p99 / 1e9 << ")\n";
+            report.add(*warm_stats);
+        }
 
-        start = std::chrono::high_resolution_clock::now();
-        random_access(mem, RANDOM_ACCESS_COUNT);
-        end = std::chrono::high_resolution_clock::now();
-        auto random_duration = std::chrono::duration<double>(end - start).count();
-        std::cout << "random access     = " << random_duration << '\n';
+        if (bench::TscClock::uses_tsc()) {
+            ticks->reset();
+            bench::evict(mem.data(), mem.size() * sizeof(int64_t));
+            random_access_latencies(mem, RANDOM_ACCESS_COUNT, *ticks);
 
+            const double ns_per_tick = 1 / bench::TscClock::ticks_per_ns();
+            std::cout << "per access (ns)   = p50 " << ticks->percentile(50) * ns_per_tick
+                      << ", p90 " << ticks->percentile(90) * ns_per_tick
+                      << ", p99 " << ticks->percentile(99) * ns_per_tick
+                      << ", p99.9 " << ticks->percentile(99.9) * ns_per_tick << '\n';
+        }
     }
 
-    
+    report.save(argc, argv);
 
     return 0;
 }
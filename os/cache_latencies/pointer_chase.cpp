@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../../common/bench.h"
+
+// Load latency against working set size. Every load depends on the one
+// before (p = p->next), so neither out-of-order execution nor the
+// prefetcher can overlap them, and the order is a random cycle over all
+// lines of the buffer, so there is no stride to predict either. ns per
+// load then steps up at each cache capacity, and detect_levels() finds
+// the steps.
+
+constexpr std::size_t CACHE_LINE = 64;
+
+struct alignas(CACHE_LINE) Line {
+    Line* next;
+};
+
+static_assert(sizeof(Line) == CACHE_LINE);
+
+// One random cycle through all `count` lines (Sattolo's algorithm, which
+// only produces single cycles), so a chase from any line visits them all
+// before coming back.
+void link_random_cycle(Line* lines, std::size_t count, std::uint64_t seed) {
+    std::vector<std::size_t> order(count);
+    for (std::size_t i = 0; i < count; ++i)
+        order[i] = i;
+
+    std::mt19937_64 gen(seed);
+    for (std::size_t i = count - 1; i > 0; --i) {
+        std::uniform_int_distribution<std::size_t> pick(0, i - 1);
+        std::swap(order[i], order[pick(gen)]);
+    }
+
+    for (std::size_t i = 0; i < count; ++i)
+        lines[order[i]].next = &lines[order[(i + 1) % count]];
+}
+
+struct Point {
+    std::size_t bytes;
+    double ns;
+};
+
+// ns per dependent load over `bytes` of lines.
+bench::Stats chase(Line* lines, std::size_t bytes) {
+    const std::size_t count = bytes / CACHE_LINE;
+    link_random_cycle(lines, count, bytes);
+
+    Line* p = lines;
+    return bench::run<bench::TscClock>(
+        "chase/" + std::to_string(bytes),
+        [&] {
+            p = p->next;
+            bench::DoNotOptimize(p);
+        },
+        bench::Options{.warmup_ms = 20, .min_time_ms = 200, .min_samples = 20, .min_sample_ns = 1'000'000}
+    );
+}
+
+// 4 KiB, 6 KiB, 8 KiB, 12 KiB, ... up to max_bytes: two points per power
+// of two so a knee is placed within a factor of 1.5.
+std::vector<std::size_t> working_sets(std::size_t max_bytes) {
+    std::vector<std::size_t> sizes;
+    for (std::size_t size = 4096; size <= max_bytes; size *= 2) {
+        sizes.push_back(size);
+        if (size + size / 2 <= max_bytes)
+            sizes.push_back(size + size / 2);
+    }
+    return sizes;
+}
+
+struct Level {
+    std::size_t capacity;   // largest working set still at this latency
+    double ns;              // median latency over the plateau
+};
+
+// Splits the curve into levels at sharp steps. A step is a point more
+// than `jump` times slower than the one before it; the slow, steady climb
+// from TLB misses inside one level never is. Then:
+//   - a lone point between two steps is on the way from one level to the
+//     next and is dropped;
+//   - neighbouring levels less than `jump` apart are one level cut by noise.
+// The last level is memory.
+std::vector<Level> detect_levels(const std::vector<Point>& curve, double jump = 1.4) {
+    std::vector<std::vector<Point>> segments;
+    for (std::size_t i = 0; i < curve.size(); ++i) {
+        if (i == 0 || curve[i].ns > curve[i - 1].ns * jump)
+            segments.emplace_back();
+        segments.back().push_back(curve[i]);
+    }
+
+    const auto median = [](const std::vector<Point>& points) {
+        std::vector<double> ns;
+        for (const Point& p : points)
+            ns.push_back(p.ns);
+        std::nth_element(ns.begin(), ns.begin() + ns.size() / 2, ns.end());
+        return ns[ns.size() / 2];
+    };
+
+    std::vector<Level> levels;
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+        if (segments[i].size() == 1 && i + 1 < segments.size())
+            continue;
+
+        const Level level{segments[i].back().bytes, median(segments[i])};
+        if (!levels.empty() && level.ns < levels.back().ns * jump)
+            levels.back().capacity = level.capacity;
+        else
+            levels.push_back(level);
+    }
+
+    return levels;
+}
+
+std::string human(std::size_t bytes) {
+    if (bytes >= (1 << 30) && bytes % (1 << 30) == 0)
+        return std::format("{} GiB", bytes >> 30);
+    if (bytes >= (1 << 20))
+        return std::format("{:.4g} MiB", bytes / double(1 << 20));
+    return std::format("{:.4g} KiB", bytes / 1024.0);
+}
+
+void log_row(const auto& bytes, const auto& ns, const auto& p99, const auto& scale) {
+    std::println("{:<10} | {:<8} | {:<8} | {}", bytes, ns, p99, scale);
+}
+
+// Usage: pointer_chase [MAX_MIB] [--csv=PATH] [--json=PATH]
+int main(int argc, char** argv) {
+    std::size_t max_bytes = std::size_t(1) << 30;
+    if (argc > 1 && !std::string_view(argv[1]).starts_with("--"))
+        max_bytes = std::size_t(std::stoul(argv[1])) << 20;
+
+    // One mapping for every size, touched up front so page faults stay out
+    // of the timings.
+    void* memory = mmap(nullptr, max_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (memory == MAP_FAILED) {
+        std::println("Could not map {}", human(max_bytes));
+        return 1;
+    }
+    Line* lines = static_cast<Line*>(memory);
+
+    bench::TscClock::calibrate();
+    bench::Report report;
+    std::vector<Point> curve;
+
+    log_row("SIZE", "NS/LOAD", "P99", "VS PREV");
+    std::println("----------------------------------------");
+    for (const std::size_t bytes : working_sets(max_bytes)) {
+        const bench::Stats stats = chase(lines, bytes);
+        const double previous = curve.empty() ? stats.p50 : curve.back().ns;
+        curve.push_back({bytes, stats.p50});
+        report.add(stats);
+
+        log_row(human(bytes), std::format("{:.2f}", stats.p50), std::format("{:.2f}", stats.p99),
+                std::format("{:.2f}", stats.p50 / previous));
+    }
+
+    std::println();
+    std::println("{:<6} | {:<10} | {}", "LEVEL", "CAPACITY", "NS/LOAD");
+    std::println("----------------------------------------");
+    const std::vector<Level> levels = detect_levels(curve);
+    for (std::size_t i = 0; i < levels.size(); ++i) {
+        const bool memory_level = i + 1 == levels.size() && levels.size() > 1;
+        std::println("{:<6} | {:<10} | {:.2f}",
+                     memory_level ? std::string("DRAM") : std::format("L{}", i + 1),
+                     memory_level ? std::string("-") : human(levels[i].capacity),
+                     levels[i].ns);
+    }
+
+    std::println();
+    const auto reported = [](int name) {
+        const long bytes = sysconf(name);
+        return bytes > 0 ? human(bytes) : std::string("?");
+    };
+    std::println("sysconf: L1d {}, L2 {}, L3 {}",
+                 reported(_SC_LEVEL1_DCACHE_SIZE), reported(_SC_LEVEL2_CACHE_SIZE), reported(_SC_LEVEL3_CACHE_SIZE));
+
+    munmap(memory, max_bytes);
+    report.save(argc, argv);
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <barrier>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <format>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "../../common/affinity.h"
+#include "../../common/bench.h"
+
+// Sustained memory bandwidth with the four STREAM kernels (McCalpin):
+//
+//     copy    c = a            2 arrays moved per element
+//     scale   b = s * c        2
+//     add     c = a + b        3
+//     triad   a = b + s * c    3
+//
+// each written once with regular stores and once with non-temporal
+// stores, which bypass the cache and skip the read-for-ownership of the
+// destination line. Every thread count from 1 to the number of allowed
+// CPUs runs on pinned threads, each on its own contiguous slice, and GB/s
+// counts only the bytes STREAM counts.
+
+// As wide as the widest non-temporal store of the target.
+#if defined(__AVX__)
+constexpr std::size_t VEC_BYTES = 32;
+#else
+constexpr std::size_t VEC_BYTES = 16;
+#endif
+
+using vec = double __attribute__((vector_size(VEC_BYTES)));
+
+constexpr std::size_t VEC = sizeof(vec) / sizeof(double);
+
+// Slices start on cache line boundaries so every vector store is aligned.
+constexpr std::size_t SLICE_ALIGN = 64 / sizeof(double);
+
+constexpr double SCALAR = 3.0;
+
+enum class Store { Regular, NonTemporal };
+
+inline vec load(const double* p) {
+    return *reinterpret_cast<const vec*>(p);
+}
+
+template<Store S>
+inline void store(double* p, vec v) {
+    if constexpr (S == Store::NonTemporal) {
+#if defined(__AVX__)
+        _mm256_stream_pd(p, v);
+#elif defined(__SSE2__)
+        _mm_stream_pd(p, v);
+#elif defined(__aarch64__)
+        asm volatile("stnp %d0, %d1, [%2]" : : "w"(v[0]), "w"(v[1]), "r"(p) : "memory");
+#else
+        *reinterpret_cast<vec*>(p) = v;
+#endif
+    } else {
+        *reinterpret_cast<vec*>(p) = v;
+    }
+}
+
+// Non-temporal stores are weakly ordered; drain them before the barrier
+// that ends the timed run.
+template<Store S>
+inline void drain() {
+#if defined(__x86_64__) || defined(__i386__)
+    if constexpr (S == Store::NonTemporal)
+        _mm_sfence();
+#endif
+}
+
+struct Arrays {
+    double* a;
+    double* b;
+    double* c;
+};
+
+template<Store S>
+void copy(Arrays& x, std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i += VEC)
+        store<S>(x.c + i, load(x.a + i));
+    drain<S>();
+}
+
+template<Store S>
+void scale(Arrays& x, std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i += VEC)
+        store<S>(x.b + i, SCALAR * load(x.c + i));
+    drain<S>();
+}
+
+template<Store S>
+void add(Arrays& x, std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i += VEC)
+        store<S>(x.c + i, load(x.a + i) + load(x.b + i));
+    drain<S>();
+}
+
+template<Store S>
+void triad(Arrays& x, std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; i += VEC)
+        store<S>(x.a + i, load(x.b + i) + SCALAR * load(x.c + i));
+    drain<S>();
+}
+
+struct Kernel {
+    const char* name;
+    std::size_t arrays;   // arrays read or written per element
+    void (*regular)(Arrays&, std::size_t, std::size_t);
+    void (*non_temporal)(Arrays&, std::size_t, std::size_t);
+    void (*expected)(double& a, double& b, double& c);   // the kernel on one element
+};
+
+constexpr Kernel KERNELS[] = {
+    {"copy",  2, copy<Store::Regular>,  copy<Store::NonTemporal>,  [](double& a, double&, double& c) { c = a; }},
+    {"scale", 2, scale<Store::Regular>, scale<Store::NonTemporal>, [](double&, double& b, double& c) { b = SCALAR * c; }},
+    {"add",   3, add<Store::Regular>,   add<Store::NonTemporal>,   [](double& a, double& b, double& c) { c = a + b; }},
+    {"triad", 3, triad<Store::Regular>, triad<Store::NonTemporal>, [](double& a, double& b, double& c) { a = b + SCALAR * c; }},
+};
+
+// Worker `worker`'s share [begin, end) of n elements, in whole cache lines.
+std::pair<std::size_t, std::size_t> slice(std::size_t n, std::size_t worker, std::size_t worker_count) {
+    const std::size_t lines = n / SLICE_ALIGN;
+    const std::size_t begin = lines * worker / worker_count * SLICE_ALIGN;
+    const std::size_t end = lines * (worker + 1) / worker_count * SLICE_ALIGN;
+    return {begin, end};
+}
+
+// Pins thread t to the t-th allowed CPU; left unpinned when the process
+// could not list any or the kernel refuses.
+void pin_thread(const std::vector<int>& cpus, std::size_t t) {
+    if (cpus.empty())
+        return;
+
+    const int cpu = cpus[t % cpus.size()];
+    if (!bench::pin_current_thread(cpu))
+        std::println("Could not pin thread {} to CPU {}", t, cpu);
+}
+
+// ns of each of `repetitions` runs of fn over the arrays, on
+// `thread_count` threads pinned to the first allowed CPUs. A barrier
+// starts every run together, and the run ends when the last thread is
+// done.
+std::vector<double> time_threads(
+    Arrays& x, std::size_t n,
+    const std::vector<int>& cpus, std::size_t thread_count,
+    void (*fn)(Arrays&, std::size_t, std::size_t), std::size_t repetitions
+) {
+    std::vector<double> times;
+    times.reserve(repetitions);
+    bench::TscClock::time_point start;
+    bool running = false;
+
+    std::barrier sync(thread_count, [&]() noexcept {
+        const auto now = bench::TscClock::now();
+        if (running)
+            times.push_back(std::chrono::duration<double, std::nano>(now - start).count());
+        start = now;
+        running = !running;
+    });
+
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t] {
+            pin_thread(cpus, t);
+            const auto [begin, end] = slice(n, t, thread_count);
+
+            for (std::size_t r = 0; r < repetitions; ++r) {
+                sync.arrive_and_wait();
+                fn(x, begin, end);
+                sync.arrive_and_wait();
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+    return times;
+}
+
+// Sets the arrays to STREAM's starting values, each of `thread_count`
+// pinned threads writing the slice it will run kernels on.
+void reset(Arrays& x, std::size_t n, const std::vector<int>& cpus, std::size_t thread_count) {
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < thread_count; ++t) {
+        threads.emplace_back([&, t] {
+            pin_thread(cpus, t);
+            const auto [begin, end] = slice(n, t, thread_count);
+            for (std::size_t i = begin; i < end; ++i) {
+                x.a[i] = 1.0;
+                x.b[i] = 2.0;
+                x.c[i] = 0.0;
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+}
+
+// Elements not holding the expected a, b and c; NaN and inf count as wrong.
+std::size_t count_wrong(const Arrays& x, std::size_t n, double a, double b, double c) {
+    const auto differs = [](double value, double expected) {
+        return !std::isfinite(value) || !(std::abs(value - expected) <= 1e-8 * std::abs(expected));
+    };
+
+    std::size_t wrong = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        if (differs(x.a[i], a) || differs(x.b[i], b) || differs(x.c[i], c))
+            ++wrong;
+    return wrong;
+}
+
+void log_row(const auto& threads, const auto& kernel, const auto& regular, const auto& non_temporal, const auto& scale) {
+    std::println("{:<6} | {:<6} | {:<8} | {:<8} | {}", threads, kernel, regular, non_temporal, scale);
+}
+
+// Usage: memory_bandwidth [MIB_PER_ARRAY] [--csv=PATH] [--json=PATH]
+int main(int argc, char** argv) {
+    std::size_t mib = 256;
+    if (argc > 1 && !std::string_view(argv[1]).starts_with("--"))
+        mib = std::stoul(argv[1]);
+
+    constexpr std::size_t REPETITIONS = 10;
+    const std::size_t n = (mib << 20) / sizeof(double) / SLICE_ALIGN * SLICE_ALIGN;
+    const std::vector<int> cpus = bench::allowed_cpus();
+    const std::size_t max_threads = std::max<std::size_t>(1, cpus.size());
+
+    Arrays x{
+        static_cast<double*>(std::aligned_alloc(64, n * sizeof(double))),
+        static_cast<double*>(std::aligned_alloc(64, n * sizeof(double))),
+        static_cast<double*>(std::aligned_alloc(64, n * sizeof(double))),
+    };
+    if (!x.a || !x.b || !x.c) {
+        std::println("Could not allocate 3 arrays of {} MiB", mib);
+        std::free(x.a);
+        std::free(x.b);
+        std::free(x.c);
+        return 1;
+    }
+
+    // First touch by one thread per CPU, so each slice of the pages lands
+    // on the NUMA node of the CPU that runs it at the highest thread count.
+    // Fewer threads get wider slices, and partly read pages that another
+    // node touched first; the later resets only rewrite them.
+    reset(x, n, cpus, max_threads);
+
+    bench::TscClock::calibrate();
+    bench::Report report;
+
+    std::println("{} MiB per array, {} CPUs, best of {} runs", mib, max_threads, REPETITIONS);
+    std::println();
+    log_row("THRDS", "KERNEL", "GB/S", "NT GB/S", "SCALE");
+    std::println("----------------------------------------");
+
+    std::size_t wrong = 0;
+    for (std::size_t threads = 1; threads <= max_threads; ++threads) {
+        // Every thread count starts over, so the values stay small and are
+        // checked for each one.
+        reset(x, n, cpus, threads);
+
+        // What every element should hold, replayed on scalars.
+        double a = 1.0, b = 2.0, c = 0.0;
+
+        for (const Kernel& kernel : KERNELS) {
+            const double bytes = double(kernel.arrays * n * sizeof(double));
+
+            const auto regular = bench::summarize(
+                std::format("{}/{}", kernel.name, threads),
+                time_threads(x, n, cpus, threads, kernel.regular, REPETITIONS), 1);
+            const auto non_temporal = bench::summarize(
+                std::format("{} nt/{}", kernel.name, threads),
+                time_threads(x, n, cpus, threads, kernel.non_temporal, REPETITIONS), 1);
+            report.add(regular);
+            report.add(non_temporal);
+
+            // Running a kernel again gives the same result, so once is enough.
+            kernel.expected(a, b, c);
+
+            // STREAM reports the best run: the others only add noise.
+            const double regular_gbs = bytes / regular.min;
+            const double non_temporal_gbs = bytes / non_temporal.min;
+            log_row(threads, kernel.name,
+                    std::format("{:.1f}", regular_gbs), std::format("{:.1f}", non_temporal_gbs),
+                    std::format("{:.2f}", non_temporal_gbs / regular_gbs));
+        }
+
+        const std::size_t differ = count_wrong(x, n, a, b, c);
+        if (differ)
+            std::println("{} elements differ from the expected result with {} threads", differ, threads);
+        wrong += differ;
+    }
+
+    std::free(x.a);
+    std::free(x.b);
+    std::free(x.c);
+
+    report.save(argc, argv);
+    return wrong ? 1 : 0;
+}
@@ -1,53 +1,28 @@
-#include <iostream>
-#include <iomanip>
-#include <chrono>
-#include <random>
-#include <functional>
-#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <array>
+#include <atomic>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <print>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../../common/affinity.h"
+#include "../../common/bench.h"
+#include "../../common/cache.h"
 
 const size_t CACHE_LINE_SIZE = 128;
-
-class ScopeTimer {
-private:
-    const char* name_;
-    std::chrono::time_point<std::chrono::high_resolution_clock> start_;
-
-public:
-    ScopeTimer(const char* name)
-        : name_(name)
-        , start_(std::chrono::high_resolution_clock::now()) {}
-
-    ~ScopeTimer() {
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration<double>(end - start_).count();
-        std::cout << name_ << ": " << duration << '\n';
-    }
-};
-
-class ManTimer {
-private:
-    std::chrono::time_point<std::chrono::high_resolution_clock> start_;
-
-public:
-    ManTimer(): start_(std::chrono::high_resolution_clock::now()) {}
-
-    double end() {
-        auto end = std::chrono::high_resolution_clock::now();
-        return std::chrono::duration<double>(end - start_).count();
-    }
-};
-
-
-void flush() {
-    const size_t BUFFER_SIZE = 256 * 1024 * 1024;  
-    char* buffer = new char[BUFFER_SIZE];
-    for (size_t i = 0; i < BUFFER_SIZE; i += CACHE_LINE_SIZE) 
-        buffer[i] = 'a';
-    delete[] buffer;
-}
-
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+const unsigned char MAX_EXPONENT = 24;
 
 void iterate_read(char* buffer, size_t buffer_size, size_t stride) {
     size_t probe = 0;
@@ -68,130 +43,293 @@ void iterate_write(char* buffer, size_t buffer_size, size_t stride) {
 }
 
 
-struct benchmark_times {
-    double mean;
-    double p99;
-};
+// `samples` passes, each starting with the buffer evicted from every
+// cache level, with every pass's ns recorded into histogram and, if given,
+// counters per pass.
+template<typename F>
+bench::Stats benchmark(
+    std::string name, const char* buffer, size_t buffer_size, F&& fn,
+    bench::Histogram& histogram, bench::PerfCounterGroup* counters = nullptr, size_t samples = 100
+) {
+    return bench::run_fresh<bench::TscClock>(
+        std::move(name),
+        [&] { bench::evict(buffer, buffer_size); },
+        fn,
+        bench::Options{
+            .warmup_ms = 0, .min_time_ms = 0, .min_samples = samples, .max_samples = samples,
+            .histogram = &histogram, .counters = counters,
+        }
+    );
+}
 
 
-benchmark_times benchmark(const std::function<void()>& fn, size_t iterations) {
-    double time_sum = 0.0;
-    double p99 = 0.0;
+enum class Pages { Regular, Transparent, HugeTlb };
+
+const char* page_name(Pages pages) {
+    switch (pages) {
+        case Pages::Regular: return "4K";
+        case Pages::Transparent: return "THP";
+        case Pages::HugeTlb: return "HUGETLB";
+    }
+    return "?";
+}
 
-    double t;
 
-    for (size_t i=0; i<iterations; ++i) {
-        flush();
-        ManTimer timer;
-        fn();
-        t = timer.end();
-        p99 = std::max(t, p99);
-        time_sum += t;
+// Mapping of at least `bytes` on the given pages, rounded up to whole huge
+// pages and touched so page faults stay out of the timings; nullptr when
+// the kernel has none to give (MAP_HUGETLB needs 2MB pages reserved in
+// /proc/sys/vm/nr_hugepages). Regular pages opt out of THP, which may be
+// on for every mapping.
+char* map_buffer(size_t bytes, Pages pages) {
+    const size_t length = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    if (pages == Pages::HugeTlb) {
+        void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        return memory == MAP_FAILED ? nullptr : static_cast<char*>(memory);
     }
 
-    return benchmark_times{time_sum / (double) iterations, p99};
+    // One huge page extra, trimmed so the buffer starts on a huge page
+    // boundary; THP only backs aligned 2MB ranges.
+    void* memory = mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+
+    char* raw = static_cast<char*>(memory);
+    char* buffer = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(raw) + HUGE_PAGE_SIZE - 1) & ~(uintptr_t(HUGE_PAGE_SIZE) - 1));
+    if (buffer != raw)
+        munmap(raw, buffer - raw);
+    munmap(buffer + length, raw + HUGE_PAGE_SIZE - buffer);
+
+    madvise(buffer, length, pages == Pages::Transparent ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+    for (size_t i = 0; i < length; i += sysconf(_SC_PAGESIZE))
+        buffer[i] = 0;
+    return buffer;
 }
 
 
-void process_main(
-    size_t buffer_size_mb,
-    unsigned char id, 
-    unsigned char process_max_exponent
-) {
-    const size_t BUFFER_SIZE = buffer_size_mb * 1024 * 1024;  
-    char* buffer = static_cast<char*>(aligned_alloc(CACHE_LINE_SIZE, BUFFER_SIZE));
-
-    for (unsigned char i = 0; i < process_max_exponent; ++i) {
-        size_t stride = 1 << (id * process_max_exponent + i);
-
-        auto[read_avg, read_p99] = benchmark(
-            [&]() { iterate_read(buffer, BUFFER_SIZE, stride); },
-            100
-        );       
-
-        auto[write_avg, write_p99] = benchmark(
-            [&]() { iterate_write(buffer, BUFFER_SIZE, stride); },
-            100
-        );       
-
-        double read_delta = read_p99 - read_avg;
-        double write_delta = write_p99 - write_avg;
-        
-        std::cout << std::left
-                  << std::setw(8) << stride
-                  << " | "
-                  << std::setw(7) << std::fixed << std::setprecision(3) << read_avg
-                  << " | "
-                  << std::setw(7) << std::fixed << std::setprecision(3) << read_p99
-                  << " | "
-                  << std::setw(8) << std::fixed << std::setprecision(3) << read_delta
-                  << " | "
-                  << std::setw(7) << std::fixed << std::setprecision(3) << write_avg
-                  << " | "
-                  << std::setw(7) << std::fixed << std::setprecision(3) << write_p99
-                  << " | "
-                  << std::setw(8) << std::fixed << std::setprecision(3) << write_delta
-                  << '\n';
+void unmap_buffer(char* buffer, size_t bytes) {
+    munmap(buffer, (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+}
+
+
+// Bytes of this process on transparent huge pages, to tell whether THP
+// actually backed the buffer or just ran out of free 2MB blocks.
+std::optional<size_t> transparent_huge_bytes() {
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string key;
+    size_t kb;
+    while (smaps >> key) {
+        if (key == "AnonHugePages:" && smaps >> kb)
+            return kb * 1024;
+        smaps.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
     }
+    return std::nullopt;
+}
+
+
+void log_row(const auto& stride, const auto& pages, const auto& read, const auto& write,
+             const auto& read_tlb, const auto& write_tlb) {
+    std::println("{:<8} | {:<7} | {:<8} | {:<8} | {:<10} | {}", stride, pages, read, write, read_tlb, write_tlb);
+}
+
+
+// The stride sweep over 4K pages, transparent huge pages and MAP_HUGETLB
+// pages side by side, as ns per access and dTLB misses per access. Past
+// 4K strides every access lands on a new 4K page, and the 64 dTLB entries
+// of a typical L1 cover 256KB of them but 128MB of 2MB pages.
+void pages_main(size_t buffer_size_mb, bench::Report& report) {
+    const size_t BUFFER_SIZE = buffer_size_mb * 1024 * 1024;
+    static const size_t SAMPLES = 10;
+
+    constexpr std::array TLB_EVENTS{bench::DTLB_MISSES, bench::DTLB_STORE_MISSES};
+    auto counters = bench::PerfCounterGroup::make(TLB_EVENTS);
+
+    std::array<char*, 3> buffers{};
+    for (Pages pages : {Pages::Regular, Pages::Transparent, Pages::HugeTlb}) {
+        const size_t huge_before = transparent_huge_bytes().value_or(0);
+        char* buffer = map_buffer(BUFFER_SIZE, pages);
+        buffers[size_t(pages)] = buffer;
+
+        if (!buffer)
+            std::println("{}: no pages available, skipped", page_name(pages));
+        else if (pages == Pages::Transparent)
+            std::println("THP: {} of {} MB on huge pages", (transparent_huge_bytes().value_or(0) - huge_before) >> 20,
+                         buffer_size_mb);
+    }
+
+    auto read = std::make_unique<bench::Histogram>();
+    auto write = std::make_unique<bench::Histogram>();
+
+    const auto per_access = [&](const bench::Stats& stats, std::string_view event) {
+        const auto misses = stats.counters.get(event);
+        return misses ? std::format("{:.3f}", *misses / BUFFER_SIZE) : std::string("-");
+    };
+
+    std::println();
+    log_row("STRIDE", "PAGES", "READ NS", "WRITE NS", "READ dTLB", "WRITE dTLB");
+    std::println("----------------------------------------");
+
+    for (unsigned char i = 0; i < MAX_EXPONENT; ++i) {
+        const size_t stride = size_t(1) << i;
+
+        for (Pages pages : {Pages::Regular, Pages::Transparent, Pages::HugeTlb}) {
+            char* buffer = buffers[size_t(pages)];
+            if (!buffer)
+                continue;
+
+            read->reset();
+            write->reset();
+
+            const bench::Stats read_stats = benchmark(
+                std::format("read/{}/{}MB/{}", page_name(pages), buffer_size_mb, stride),
+                buffer, BUFFER_SIZE, [&]() { iterate_read(buffer, BUFFER_SIZE, stride); },
+                *read, counters ? &*counters : nullptr, SAMPLES);
+            const bench::Stats write_stats = benchmark(
+                std::format("write/{}/{}MB/{}", page_name(pages), buffer_size_mb, stride),
+                buffer, BUFFER_SIZE, [&]() { iterate_write(buffer, BUFFER_SIZE, stride); },
+                *write, counters ? &*counters : nullptr, SAMPLES);
+            report.add(read_stats);
+            report.add(write_stats);
+
+            log_row(stride, page_name(pages),
+                    std::format("{:.3f}", read_stats.p50 / BUFFER_SIZE),
+                    std::format("{:.3f}", write_stats.p50 / BUFFER_SIZE),
+                    per_access(read_stats, bench::DTLB_MISSES.name),
+                    per_access(write_stats, bench::DTLB_STORE_MISSES.name));
+        }
+    }
+
+    for (char* buffer : buffers)
+        if (buffer)
+            unmap_buffer(buffer, BUFFER_SIZE);
+}
+
 
-    delete[] buffer;
+void log_sweep_row(const auto& stride, const auto& read_p50, const auto& read_p99, const auto& read_diff,
+                   const auto& write_p50, const auto& write_p99, const auto& write_diff) {
+    std::println("{:<8} | {:<7} | {:<7} | {:<8} | {:<7} | {:<7} | {}",
+                 stride, read_p50, read_p99, read_diff, write_p50, write_p99, write_diff);
 }
 
 
-void buffered_main(size_t buffer_size_mb) {
-    std::cout << std::left
-              << std::setw(8) << ""
-              << " | "
-              << std::setw(28) << "READ"
-              << " | "
-              << std::setw(7) << "WRITE"
-              << '\n';
-
-    std::cout << std::left
-              << std::setw(8) << "STRIDE"
-              << " | "
-              << std::setw(7) << "P50"
-              << " | "
-              << std::setw(7) <<  "P99"
-              << " | "
-              << std::setw(8) << "DIFF"
-              << " | "
-              << std::setw(7) << "P50"
-              << " | "
-              << std::setw(7) <<  "P99"
-              << " | "
-              << std::setw(8) << "DIFF"
-              << '\n';
-
-    static const unsigned char MAX_EXPONENT = 24;
-    static const unsigned char PROCESS_COUNT = 8;
-    static const unsigned char PROCESS_MAX_EXPONENT = MAX_EXPONENT / PROCESS_COUNT;
-
-    pid_t pid;
-
-    for (unsigned char i = 1; i < PROCESS_COUNT; ++i) {
-        pid = fork();
-
-        if (pid == 0) {
-            process_main(buffer_size_mb, i, PROCESS_MAX_EXPONENT);
-            _exit(0);
+// The stride sweep, 100 read and 100 write passes per stride, on one
+// worker per allowed CPU (only one with `sequential`), each pinned to its
+// CPU and with its own buffer. Passes are handed out a task of
+// SAMPLES_PER_TASK at a time in stride order, so the workers share every
+// stride and its histograms, and the table is printed once they are done.
+// Concurrent workers still compete for the LLC and memory bandwidth:
+// run them on isolated cores (taskset, isolcpus) or go sequential for
+// clean numbers. False if the buffers could not be allocated.
+bool buffered_main(size_t buffer_size_mb, bool sequential, bench::Report& report) {
+    const size_t BUFFER_SIZE = buffer_size_mb * 1024 * 1024;
+    static const size_t SAMPLES = 100;
+    static const size_t SAMPLES_PER_TASK = 10;
+    static const size_t TASKS_PER_STRIDE = SAMPLES / SAMPLES_PER_TASK;
+
+    const std::vector<int> cpus = bench::allowed_cpus();
+    const size_t worker_count = sequential || cpus.empty() ? 1 : cpus.size();
+
+    std::vector<std::unique_ptr<bench::Histogram>> read, write;
+    for (unsigned char i = 0; i < MAX_EXPONENT; ++i) {
+        read.push_back(std::make_unique<bench::Histogram>());
+        write.push_back(std::make_unique<bench::Histogram>());
+    }
+
+    std::vector<char*> buffers;
+    for (size_t w = 0; w < worker_count; ++w) {
+        buffers.push_back(static_cast<char*>(aligned_alloc(CACHE_LINE_SIZE, BUFFER_SIZE)));
+        if (!buffers.back()) {
+            std::println("Could not allocate {} buffers of {}MB", worker_count, buffer_size_mb);
+            for (char* buffer : buffers)
+                std::free(buffer);
+            return false;
         }
     }
 
-    process_main(buffer_size_mb, 0, PROCESS_MAX_EXPONENT);
+    std::atomic<size_t> next_task{0};
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < worker_count; ++w) {
+        workers.emplace_back([&, w] {
+            if (!cpus.empty() && !bench::pin_current_thread(cpus[w]))
+                std::println("Could not pin worker {} to CPU {}", w, cpus[w]);
+
+            // Touched once here, so page faults stay out of the first pass
+            // and the pages sit on this CPU's NUMA node.
+            char* buffer = buffers[w];
+            std::memset(buffer, 0, BUFFER_SIZE);
+
+            for (size_t task; (task = next_task.fetch_add(1)) < MAX_EXPONENT * TASKS_PER_STRIDE;) {
+                const size_t exponent = task / TASKS_PER_STRIDE;
+                const size_t stride = size_t(1) << exponent;
+
+                benchmark("", buffer, BUFFER_SIZE, [&]() { iterate_read(buffer, BUFFER_SIZE, stride); },
+                          *read[exponent], nullptr, SAMPLES_PER_TASK);
+                benchmark("", buffer, BUFFER_SIZE, [&]() { iterate_write(buffer, BUFFER_SIZE, stride); },
+                          *write[exponent], nullptr, SAMPLES_PER_TASK);
+            }
+
+        });
+    }
+    for (auto& worker : workers)
+        worker.join();
+    for (char* buffer : buffers)
+        std::free(buffer);
+
+    std::println("{} worker{}", worker_count, worker_count == 1 ? "" : "s");
+    std::println("{:<8} | {:<28} | {}", "", "READ", "WRITE");
+    log_sweep_row("STRIDE", "P50", "P99", "DIFF", "P50", "P99", "DIFF");
+    std::println("----------------------------------------");
+
+    for (unsigned char i = 0; i < MAX_EXPONENT; ++i) {
+        const size_t stride = size_t(1) << i;
+
+        const bench::Stats read_stats = bench::summarize(std::format("read/{}MB/{}", buffer_size_mb, stride), *read[i]);
+        const bench::Stats write_stats = bench::summarize(std::format("write/{}MB/{}", buffer_size_mb, stride), *write[i]);
+        report.add(read_stats);
+        report.add(write_stats);
+
+        const auto seconds = [](double ns) { return std::format("{:.3f}", ns / 1e9); };
+        log_sweep_row(stride,
+                      seconds(read_stats.p50), seconds(read_stats.p99), seconds(read_stats.p99 - read_stats.p50),
+                      seconds(write_stats.p50), seconds(write_stats.p99), seconds(write_stats.p99 - write_stats.p50));
+    }
 
-    for (unsigned char i = 1; i < PROCESS_COUNT; ++i) 
-        wait(nullptr);
+    return true;
 }
 
 
-int main() {
-    std::array<size_t, 3> buffer_sizes{16,32,64};
+// Usage: random_access [--sequential] [--pages [MB]] [--csv=PATH] [--json=PATH]
+int main(int argc, char** argv) {
+    bool sequential = false;
+    std::optional<size_t> pages_mb;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--sequential") {
+            sequential = true;
+        } else if (arg == "--pages") {
+            pages_mb = 64;
+            if (i + 1 < argc && !std::string_view(argv[i + 1]).starts_with("--"))
+                pages_mb = std::stoul(argv[++i]);
+        }
+    }
+
+    bench::TscClock::calibrate();
+    bench::Report report;
 
-    for (auto b: buffer_sizes) {
-        std::cout << "\n\n>>> TESTING BUFFER SIZE OF " << b << "MB\n";
-        buffered_main(b);
+    if (pages_mb) {
+        pages_main(*pages_mb, report);
+    } else {
+        std::array<size_t, 3> buffer_sizes{16,32,64};
+
+        for (auto b: buffer_sizes) {
+            std::println("\n\n>>> TESTING BUFFER SIZE OF {}MB", b);
+            if (!buffered_main(b, sequential, report))
+                return 1;
+        }
     }
 
+    report.save(argc, argv);
     return 0;
 }